@@ -0,0 +1,163 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#ifdef CONFIG_ALLOC_STATS
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "alloc_stats.h"
+
+static void *(*real_malloc)(size_t size);
+static void *(*real_calloc)(size_t nmemb, size_t size);
+static void *(*real_realloc)(void *ptr, size_t size);
+static void (*real_free)(void *ptr);
+static int (*real_posix_memalign)(void **ptr, size_t align, size_t size);
+static void *(*real_aligned_alloc)(size_t align, size_t size);
+
+static unsigned long long allocs;
+static unsigned long long frees;
+
+/* dlsym() may allocate before the real functions are resolved */
+static char boot_buf[4096] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static void *boot_alloc(size_t size)
+{
+	void *ret;
+
+	size = (size + 15) & ~(size_t)15;
+
+	if (size > sizeof(boot_buf) - boot_used)
+		return NULL;
+
+	ret = boot_buf + boot_used;
+	boot_used += size;
+
+	return ret;
+}
+
+static int is_boot(void *ptr)
+{
+	return (char *)ptr >= boot_buf && (char *)ptr < boot_buf + sizeof(boot_buf);
+}
+
+__attribute__((constructor))
+static void resolve(void)
+{
+	static int resolving;
+
+	if (resolving || real_free)
+		return;
+
+	resolving = 1;
+
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+
+	resolving = 0;
+}
+
+static void count(unsigned long long *cnt)
+{
+	__atomic_fetch_add(cnt, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+	resolve();
+
+	if (!real_malloc)
+		return boot_alloc(size);
+
+	count(&allocs);
+
+	return real_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	resolve();
+
+	/* The boot buffer is zeroed and never reused */
+	if (!real_calloc) {
+		if (size && nmemb > SIZE_MAX / size)
+			return NULL;
+
+		return boot_alloc(nmemb * size);
+	}
+
+	count(&allocs);
+
+	return real_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *ret;
+
+	resolve();
+
+	if (!is_boot(ptr)) {
+		count(&allocs);
+		return real_realloc(ptr, size);
+	}
+
+	/* The old size is unknown, copy as much as the boot buffer holds */
+	ret = malloc(size);
+	if (ret) {
+		size_t left = boot_buf + sizeof(boot_buf) - (char *)ptr;
+
+		memcpy(ret, ptr, size < left ? size : left);
+	}
+
+	return ret;
+}
+
+void free(void *ptr)
+{
+	if (!ptr || is_boot(ptr))
+		return;
+
+	count(&frees);
+
+	real_free(ptr);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+	resolve();
+
+	count(&allocs);
+
+	return real_posix_memalign(ptr, align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	resolve();
+
+	count(&allocs);
+
+	return real_aligned_alloc(align, size);
+}
+
+unsigned long long alloc_stats_allocs(void)
+{
+	return __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+}
+
+unsigned long long alloc_stats_frees(void)
+{
+	return __atomic_load_n(&frees, __ATOMIC_RELAXED);
+}
+
+#endif /* CONFIG_ALLOC_STATS */
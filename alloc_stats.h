@@ -0,0 +1,42 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Heap allocation counters.
+
+   Built with make ALLOC_STATS=1 the malloc() family of functions is
+   interposed and each call that returns new memory is counted, otherwise the
+   counters always read zero. The render and input paths are supposed to run
+   without any allocations once the caches were set up.
+
+  */
+
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#ifdef CONFIG_ALLOC_STATS
+
+/*
+ * Returns the number of allocations and frees since the start.
+ */
+unsigned long long alloc_stats_allocs(void);
+unsigned long long alloc_stats_frees(void);
+
+#else
+
+static inline unsigned long long alloc_stats_allocs(void)
+{
+	return 0;
+}
+
+static inline unsigned long long alloc_stats_frees(void)
+{
+	return 0;
+}
+
+#endif /* CONFIG_ALLOC_STATS */
+
+#endif /* ALLOC_STATS_H */
@@ -0,0 +1,475 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Microbenchmarks for the render primitives.
+
+   The terminal is compiled in with the main() left out and draws into
+   pixmaps attached to a fake backend whose flip and update are no-ops, so
+   that only the rendering itself is measured.
+
+   Built with make ALLOC_STATS=1 the benchmark fails when a primitive
+   allocates after the warm up call.
+
+  */
+
+#define TERMINI_BENCH
+/* Most of the event handling is not called from the benchmark */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../termini.c"
+
+#include <inttypes.h>
+
+#include "../alloc_stats.h"
+
+#define BENCH_COLS 80
+#define BENCH_ROWS 25
+#define MAX_FONTS 16
+
+static uint64_t min_ns = 200000000;
+static int json;
+static int results;
+
+static const char *cur_pixel_type;
+static const char *cur_font;
+
+static void bench_flip(gp_backend *self)
+{
+	(void)self;
+}
+
+static void bench_update_rect(gp_backend *self, gp_coord x0, gp_coord y0,
+                              gp_coord x1, gp_coord y1)
+{
+	(void)self;
+	(void)x0;
+	(void)y0;
+	(void)x1;
+	(void)y1;
+}
+
+static gp_backend bench_backend = {
+	.name = "bench",
+	.flip = bench_flip,
+	.update_rect = bench_update_rect,
+};
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void print_result(const char *primitive, uint64_t ops, double ns_per_op)
+{
+	if (!json) {
+		printf("%s,%s,%s,%s,%s,%" PRIu64 ",%.2f\n", cur_pixel_type, cur_font,
+		       cell_kernels_name(), grid_mode ? "grid" : "screen", primitive,
+		       ops, ns_per_op);
+		return;
+	}
+
+	printf("%s\n  {\"pixel_type\": \"%s\", \"font\": \"%s\", \"kernels\": \"%s\", "
+	       "\"cells\": \"%s\", \"primitive\": \"%s\", \"ops\": %" PRIu64 ", "
+	       "\"ns_per_op\": %.2f}",
+	       results ? "," : "", cur_pixel_type, cur_font, cell_kernels_name(),
+	       grid_mode ? "grid" : "screen", primitive, ops, ns_per_op);
+
+	results++;
+}
+
+/*
+ * Calls fn() until at least min_ns elapsed, each call does ops operations.
+ */
+static void bench_run(const char *primitive, void (*fn)(void), unsigned int ops)
+{
+	uint64_t calls = 0, start, elapsed;
+	unsigned long long allocs;
+
+	/* warm up caches */
+	fn();
+
+	allocs = alloc_stats_allocs();
+	start = time_ns();
+
+	do {
+		fn();
+		calls++;
+		elapsed = time_ns() - start;
+	} while (elapsed < min_ns);
+
+	/* Counted only in the ALLOC_STATS build, the steady state must not allocate */
+	allocs = alloc_stats_allocs() - allocs;
+	if (allocs) {
+		fprintf(stderr, "%s: %llu allocations in %llu calls\n",
+		        primitive, allocs, (unsigned long long)calls);
+		exit(1);
+	}
+
+	print_result(primitive, calls * ops, (double)elapsed / (calls * ops));
+}
+
+static void bench_draw_cell(void)
+{
+	VTermPos pos;
+
+	for (pos.row = 0; pos.row < (int)rows; pos.row++) {
+		for (pos.col = 0; pos.col < (int)cols; pos.col++)
+			draw_cell(pos, 0);
+	}
+}
+
+static const uint32_t frames[] = {
+	0x2500, 0x2502, 0x250c, 0x2510, 0x2514, 0x2518,
+	0x251c, 0x2524, 0x252c, 0x2534, 0x253c,
+};
+
+static void bench_draw_utf8_frames(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < GP_ARRAY_SIZE(frames); i++)
+		draw_utf8_frames(i * char_width, 0, frames[i], colors[fg_color_idx]);
+}
+
+static void bench_repaint_damage(void)
+{
+	VTermRect rect = {.start_row = 0, .end_row = rows, .start_col = 0, .end_col = cols};
+
+	merge_damage(rect);
+	repaint_damage();
+}
+
+#define MERGE_RECTS 64
+
+static VTermRect merge_rects[MERGE_RECTS];
+
+static void bench_merge_damage(void)
+{
+	unsigned int i;
+
+	damage_repainted = 1;
+
+	for (i = 0; i < MERGE_RECTS; i++)
+		merge_damage(merge_rects[i]);
+}
+
+static void bench_cursor(void)
+{
+	clear_cursor();
+	repaint_cursor();
+}
+
+static gp_event key_events[] = {
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_UP}},
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_LEFT}},
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_PAGE_DOWN}},
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_HOME}},
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_F5}},
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_F12}},
+	{.type = GP_EV_KEY, .code = GP_EV_KEY_DOWN, .key = {.key = GP_KEY_A}},
+};
+
+static int null_fd;
+
+static void bench_key_to_console_xterm(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < GP_ARRAY_SIZE(key_events); i++)
+		key_to_console_xterm(&key_events[i], null_fd);
+}
+
+/*
+ * Fills the screen with colored text, bold and line drawing characters.
+ */
+static void fill_screen(void)
+{
+	char buf[256];
+	unsigned int row;
+	int len;
+
+	for (row = 0; row < rows; row++) {
+		len = snprintf(buf, sizeof(buf),
+		               "\e[%u;%um%02u The quick brown fox \e[1mjumps\e[22m over "
+		               "\xe2\x94\x8c\xe2\x94\x80\xe2\x94\x90 the lazy dog 0123456789 "
+		               "abcdefghijklmnopqrstuvwxyz ABCDEF\e[0m",
+		               30 + row % 8, 40 + (row + 1) % 8, row);
+		vterm_input_write(vt, buf, len);
+
+		if (row + 1 < rows)
+			vterm_input_write(vt, "\r\n", 2);
+	}
+}
+
+/*
+ * Build log like output, colored prefixes, lines that wrap, UTF-8, tabs and
+ * line drawing in between plain text.
+ */
+static char text_buf[64 * 1024];
+static size_t text_len;
+
+static void text_init(void)
+{
+	static const char *lines[] = {
+		"gcc -W -Wall -Wextra -O2 -ggdb -c termini.c -o termini.o",
+		"make[1]: Entering directory '/usr/src/termini'\tdone",
+		"\e(0lqqqqk\e(B box \xc3\xa4\xc3\xb6\xc3\xbc \xe2\x94\x80\xe2\x94\x80 "
+		"caf\xc3\xa9 ok",
+		"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod "
+		"tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim "
+		"veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea",
+		"\e[1mwarning:\e[22m unused variable 'x' [-Wunused-variable]",
+	};
+	unsigned int line = 0;
+
+	while (text_len + 512 < sizeof(text_buf)) {
+		text_len += snprintf(text_buf + text_len, sizeof(text_buf) - text_len,
+		                     "\e[3%um[%5u]\e[0m %s\r\n", line % 8, line,
+		                     lines[line % GP_ARRAY_SIZE(lines)]);
+		line++;
+	}
+}
+
+static void bench_term_input(void)
+{
+	term_input(text_buf, text_len);
+}
+
+/*
+ * Feeds the text in odd sized chunks so that the runs and the sequences are
+ * split between the reads.
+ */
+static void text_feed(void)
+{
+	size_t off, n;
+
+	vterm_input_write(vt, "\ec", 2);
+	fastpath_reset();
+
+	for (off = 0; off < text_len; off += n) {
+		n = GP_MIN(text_len - off, 997u);
+		term_input(text_buf + off, n);
+	}
+}
+
+/*
+ * Checks that the fast path ends up with the same grid and cursor as libvterm.
+ */
+static void fastpath_parity(void)
+{
+	static struct grid_cell ref[BENCH_ROWS][BENCH_COLS];
+	VTermState *vs = vterm_obtain_state(vt);
+	VTermPos ref_pos, pos;
+	int row;
+
+	fastpath_enabled = 0;
+	text_feed();
+	vterm_state_get_cursorpos(vs, &ref_pos);
+
+	for (row = 0; row < BENCH_ROWS; row++)
+		memcpy(ref[row], grid_row[row], sizeof(ref[row]));
+
+	fastpath_enabled = 1;
+	text_feed();
+	vterm_state_get_cursorpos(vs, &pos);
+
+	for (row = 0; row < BENCH_ROWS; row++) {
+		if (memcmp(ref[row], grid_row[row], sizeof(ref[row]))) {
+			fprintf(stderr, "Fast path grid mismatch at row %i\n", row);
+			exit(1);
+		}
+	}
+
+	if (pos.row != ref_pos.row || pos.col != ref_pos.col) {
+		fprintf(stderr, "Fast path cursor mismatch %i:%i expected %i:%i\n",
+		        pos.row, pos.col, ref_pos.row, ref_pos.col);
+		exit(1);
+	}
+}
+
+static void bench_setup(gp_pixel_type type, const gp_font_family *family)
+{
+	static gp_text_style style, style_bold;
+	unsigned int i;
+
+	style.font = gp_font_family_face_lookup(family, GP_FONT_MONO);
+	style.pixel_xmul = 1;
+	style.pixel_ymul = 1;
+
+	style_bold.font = gp_font_family_face_lookup(family, GP_FONT_MONO | GP_FONT_BOLD);
+	style_bold.pixel_xmul = 1;
+	style_bold.pixel_ymul = 1;
+
+	text_style = &style;
+	text_style_bold = style_bold.font ? &style_bold : &style;
+
+	char_width = gp_text_max_width(text_style, 1);
+	char_height = gp_text_height(text_style);
+
+	cols = BENCH_COLS;
+	rows = BENCH_ROWS;
+
+	if (bench_backend.pixmap)
+		gp_pixmap_free(bench_backend.pixmap);
+
+	bench_backend.pixmap = gp_pixmap_alloc(cols * char_width, rows * char_height, type);
+	if (!bench_backend.pixmap) {
+		fprintf(stderr, "Failed to allocate pixmap\n");
+		exit(1);
+	}
+
+	backend = &bench_backend;
+	is_grayscale = gp_pixel_size(type) <= 4;
+	colors_init(0);
+
+	if (vt) {
+		if (grid_mode)
+			grid_exit();
+
+		vterm_free(vt);
+	}
+
+	term_init();
+	fill_screen();
+	damage_repainted = 1;
+
+	cursor_col = cols / 2;
+	cursor_row = rows / 2;
+	cursor_visible = 1;
+	focused = 1;
+
+	srand(0);
+	for (i = 0; i < MERGE_RECTS; i++) {
+		merge_rects[i].start_row = rand() % rows;
+		merge_rects[i].end_row = merge_rects[i].start_row + 1;
+		merge_rects[i].start_col = rand() % cols;
+		merge_rects[i].end_col = merge_rects[i].start_col + 1 + rand() % 8;
+	}
+}
+
+static void bench_all(gp_pixel_type type, const gp_font_family *family)
+{
+	if (!gp_font_family_face_lookup(family, GP_FONT_MONO))
+		return;
+
+	cur_pixel_type = gp_pixel_type_name(type);
+	cur_font = family->family_name;
+
+	bench_setup(type, family);
+
+	bench_run("draw_cell", bench_draw_cell, rows * cols);
+	bench_run("draw_utf8_frames", bench_draw_utf8_frames, GP_ARRAY_SIZE(frames));
+	bench_run("repaint_damage_full", bench_repaint_damage, 1);
+	bench_run("merge_damage", bench_merge_damage, MERGE_RECTS);
+	bench_run("cursor_clear_repaint", bench_cursor, 1);
+	bench_run("key_to_console_xterm", bench_key_to_console_xterm,
+	          GP_ARRAY_SIZE(key_events));
+
+	/* Parser throughput in ns per byte, these overwrite the screen */
+	fastpath_enabled = 0;
+	bench_run("term_input", bench_term_input, text_len);
+
+	if (grid_mode) {
+		fastpath_parity();
+		bench_run("term_input_fastpath", bench_term_input, text_len);
+	}
+}
+
+static const gp_pixel_type pixel_types[] = {
+	GP_PIXEL_G1,
+	GP_PIXEL_G2,
+	GP_PIXEL_RGB565,
+	GP_PIXEL_xRGB8888,
+};
+
+static void bench_help(const char *name, int exit_val)
+{
+	printf("usage: %s [-g] [-j] [-t min_ms] [-F font_family]...\n\n", name);
+	printf(" -g render from the grid instead of the libvterm screen\n");
+	printf(" -j output JSON instead of CSV\n");
+	printf(" -t minimal time per primitive in milliseconds (default %u)\n",
+	       (unsigned int)(min_ns / 1000000));
+	printf(" -F font family to run with, can be repeated (default all)\n");
+
+	exit(exit_val);
+}
+
+int main(int argc, char *argv[])
+{
+	const gp_font_family *families[MAX_FONTS];
+	unsigned int nfamilies = 0, i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "F:ghjt:")) != -1) {
+		switch (opt) {
+		case 'F':
+			if (nfamilies >= MAX_FONTS) {
+				fprintf(stderr, "Too many font families\n");
+				return 1;
+			}
+
+			families[nfamilies] = gp_font_family_lookup(optarg);
+			if (!families[nfamilies]) {
+				fprintf(stderr, "Font family %s not found\n", optarg);
+				return 1;
+			}
+			nfamilies++;
+		break;
+		case 'g':
+			grid_mode = 1;
+		break;
+		case 'h':
+			bench_help(argv[0], 0);
+		break;
+		case 'j':
+			json = 1;
+		break;
+		case 't':
+			min_ns = (uint64_t)atoi(optarg) * 1000000;
+		break;
+		default:
+			bench_help(argv[0], 1);
+		}
+	}
+
+	if (!nfamilies) {
+		gp_fonts_iter iter;
+		const gp_font_family *f;
+
+		GP_FONT_FAMILY_FOREACH(&iter, f) {
+			if (nfamilies < MAX_FONTS)
+				families[nfamilies++] = f;
+		}
+	}
+
+	null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd < 0) {
+		fprintf(stderr, "Failed to open /dev/null\n");
+		return 1;
+	}
+
+	cell_kernels_init();
+	text_init();
+
+	if (json)
+		printf("[");
+	else
+		printf("pixel_type,font,kernels,cells,primitive,ops,ns_per_op\n");
+
+	for (i = 0; i < GP_ARRAY_SIZE(pixel_types); i++) {
+		for (j = 0; j < nfamilies; j++)
+			bench_all(pixel_types[i], families[j]);
+	}
+
+	if (json)
+		printf("\n]\n");
+
+	return 0;
+}
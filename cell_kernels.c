@@ -0,0 +1,760 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+# define HAVE_NEON_KERNELS 1
+# include <arm_neon.h>
+#endif
+
+#include "mem.h"
+#include "cell_kernels.h"
+
+struct cell_kernels_stats cell_kernels_stats;
+
+struct kernels {
+	const char *name;
+	int (*supported)(void);
+	void (*fill16)(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint16_t px);
+	void (*fill32)(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint32_t px);
+	void (*expand16)(uint8_t *dst, const uint8_t *bits, unsigned int w, uint16_t fg, uint16_t bg);
+	void (*expand32)(uint8_t *dst, const uint8_t *bits, unsigned int w, uint32_t fg, uint32_t bg);
+};
+
+/*
+ * Scalar kernels, these are used for the tails by the vector kernels as well.
+ */
+static int scalar_supported(void)
+{
+	return 1;
+}
+
+static void scalar_fill16(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint16_t px)
+{
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint16_t *row = (uint16_t *)(dst + j * stride);
+
+		for (i = 0; i < w; i++)
+			row[i] = px;
+	}
+}
+
+static void scalar_fill32(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint32_t px)
+{
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint32_t *row = (uint32_t *)(dst + j * stride);
+
+		for (i = 0; i < w; i++)
+			row[i] = px;
+	}
+}
+
+static void scalar_expand16(uint8_t *dst, const uint8_t *bits, unsigned int w, uint16_t fg, uint16_t bg)
+{
+	uint16_t *row = (uint16_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i < w; i++)
+		row[i] = (bits[i>>3] & (0x80>>(i&7))) ? fg : bg;
+}
+
+static void scalar_expand32(uint8_t *dst, const uint8_t *bits, unsigned int w, uint32_t fg, uint32_t bg)
+{
+	uint32_t *row = (uint32_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i < w; i++)
+		row[i] = (bits[i>>3] & (0x80>>(i&7))) ? fg : bg;
+}
+
+/*
+ * There is no sane way to vectorize 3 byte pixels, we fill the first 16
+ * pixels, which is 48 bytes i.e. multiple of 16, and copy the pattern for the
+ * rest of the row, the memcpy() is vectorized anyway.
+ */
+static void fill24(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint32_t px)
+{
+	uint8_t pattern[48];
+	unsigned int i, j;
+
+	for (i = 0; i < 16; i++) {
+		pattern[3*i] = px & 0xff;
+		pattern[3*i+1] = (px >> 8) & 0xff;
+		pattern[3*i+2] = (px >> 16) & 0xff;
+	}
+
+	for (j = 0; j < h; j++) {
+		uint8_t *row = dst + j * stride;
+		unsigned int bytes = 3 * w;
+
+		for (i = 0; i + sizeof(pattern) <= bytes; i += sizeof(pattern))
+			memcpy(row + i, pattern, sizeof(pattern));
+
+		memcpy(row + i, pattern, bytes - i);
+	}
+}
+
+static void expand24(uint8_t *dst, const uint8_t *bits, unsigned int w, uint32_t fg, uint32_t bg)
+{
+	unsigned int i;
+
+	for (i = 0; i < w; i++) {
+		uint32_t px = (bits[i>>3] & (0x80>>(i&7))) ? fg : bg;
+
+		dst[3*i] = px & 0xff;
+		dst[3*i+1] = (px >> 8) & 0xff;
+		dst[3*i+2] = (px >> 16) & 0xff;
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+
+static int sse2_supported(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void sse2_fill16(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint16_t px)
+{
+	__m128i v = _mm_set1_epi16(px);
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint16_t *row = (uint16_t *)(dst + j * stride);
+
+		for (i = 0; i + 8 <= w; i += 8)
+			_mm_storeu_si128((__m128i *)(row + i), v);
+
+		for (; i < w; i++)
+			row[i] = px;
+	}
+}
+
+__attribute__((target("sse2")))
+static void sse2_fill32(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint32_t px)
+{
+	__m128i v = _mm_set1_epi32(px);
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint32_t *row = (uint32_t *)(dst + j * stride);
+
+		for (i = 0; i + 4 <= w; i += 4)
+			_mm_storeu_si128((__m128i *)(row + i), v);
+
+		for (; i < w; i++)
+			row[i] = px;
+	}
+}
+
+__attribute__((target("sse2")))
+static void sse2_expand16(uint8_t *dst, const uint8_t *bits, unsigned int w, uint16_t fg, uint16_t bg)
+{
+	const __m128i sel = _mm_setr_epi16(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	__m128i vfg = _mm_set1_epi16(fg);
+	__m128i vbg = _mm_set1_epi16(bg);
+	uint16_t *row = (uint16_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= w; i += 8) {
+		__m128i b = _mm_set1_epi16(bits[i>>3]);
+		__m128i m = _mm_cmpeq_epi16(_mm_and_si128(b, sel), sel);
+		__m128i px = _mm_or_si128(_mm_and_si128(m, vfg), _mm_andnot_si128(m, vbg));
+
+		_mm_storeu_si128((__m128i *)(row + i), px);
+	}
+
+	if (i < w)
+		scalar_expand16((uint8_t *)(row + i), bits + (i>>3), w - i, fg, bg);
+}
+
+__attribute__((target("sse2")))
+static void sse2_expand32(uint8_t *dst, const uint8_t *bits, unsigned int w, uint32_t fg, uint32_t bg)
+{
+	const __m128i sel_hi = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+	const __m128i sel_lo = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+	__m128i vfg = _mm_set1_epi32(fg);
+	__m128i vbg = _mm_set1_epi32(bg);
+	uint32_t *row = (uint32_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= w; i += 8) {
+		__m128i b = _mm_set1_epi32(bits[i>>3]);
+		__m128i m_hi = _mm_cmpeq_epi32(_mm_and_si128(b, sel_hi), sel_hi);
+		__m128i m_lo = _mm_cmpeq_epi32(_mm_and_si128(b, sel_lo), sel_lo);
+
+		_mm_storeu_si128((__m128i *)(row + i),
+		                 _mm_or_si128(_mm_and_si128(m_hi, vfg), _mm_andnot_si128(m_hi, vbg)));
+		_mm_storeu_si128((__m128i *)(row + i + 4),
+		                 _mm_or_si128(_mm_and_si128(m_lo, vfg), _mm_andnot_si128(m_lo, vbg)));
+	}
+
+	if (i < w)
+		scalar_expand32((uint8_t *)(row + i), bits + (i>>3), w - i, fg, bg);
+}
+
+static int avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void avx2_fill16(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint16_t px)
+{
+	__m256i v = _mm256_set1_epi16(px);
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint16_t *row = (uint16_t *)(dst + j * stride);
+
+		for (i = 0; i + 16 <= w; i += 16)
+			_mm256_storeu_si256((__m256i *)(row + i), v);
+
+		if (i + 8 <= w) {
+			_mm_storeu_si128((__m128i *)(row + i), _mm256_castsi256_si128(v));
+			i += 8;
+		}
+
+		for (; i < w; i++)
+			row[i] = px;
+	}
+}
+
+__attribute__((target("avx2")))
+static void avx2_fill32(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint32_t px)
+{
+	__m256i v = _mm256_set1_epi32(px);
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint32_t *row = (uint32_t *)(dst + j * stride);
+
+		for (i = 0; i + 8 <= w; i += 8)
+			_mm256_storeu_si256((__m256i *)(row + i), v);
+
+		if (i + 4 <= w) {
+			_mm_storeu_si128((__m128i *)(row + i), _mm256_castsi256_si128(v));
+			i += 4;
+		}
+
+		for (; i < w; i++)
+			row[i] = px;
+	}
+}
+
+/*
+ * Expands two glyph bytes into 16 pixels at once.
+ */
+__attribute__((target("avx2")))
+static void avx2_expand16(uint8_t *dst, const uint8_t *bits, unsigned int w, uint16_t fg, uint16_t bg)
+{
+	const __m256i sel = _mm256_setr_epi16(0x8000, 0x4000, 0x2000, 0x1000, 0x0800, 0x0400, 0x0200, 0x0100,
+	                                      0x0080, 0x0040, 0x0020, 0x0010, 0x0008, 0x0004, 0x0002, 0x0001);
+	__m256i vfg = _mm256_set1_epi16(fg);
+	__m256i vbg = _mm256_set1_epi16(bg);
+	uint16_t *row = (uint16_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= w; i += 16) {
+		__m256i b = _mm256_set1_epi16((bits[i>>3]<<8) | bits[(i>>3)+1]);
+		__m256i m = _mm256_cmpeq_epi16(_mm256_and_si256(b, sel), sel);
+
+		_mm256_storeu_si256((__m256i *)(row + i), _mm256_blendv_epi8(vbg, vfg, m));
+	}
+
+	if (i < w)
+		sse2_expand16((uint8_t *)(row + i), bits + (i>>3), w - i, fg, bg);
+}
+
+__attribute__((target("avx2")))
+static void avx2_expand32(uint8_t *dst, const uint8_t *bits, unsigned int w, uint32_t fg, uint32_t bg)
+{
+	const __m256i sel = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	__m256i vfg = _mm256_set1_epi32(fg);
+	__m256i vbg = _mm256_set1_epi32(bg);
+	uint32_t *row = (uint32_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= w; i += 8) {
+		__m256i b = _mm256_set1_epi32(bits[i>>3]);
+		__m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(b, sel), sel);
+
+		_mm256_storeu_si256((__m256i *)(row + i), _mm256_blendv_epi8(vbg, vfg, m));
+	}
+
+	if (i < w)
+		scalar_expand32((uint8_t *)(row + i), bits + (i>>3), w - i, fg, bg);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+
+static int neon_supported(void)
+{
+	return 1;
+}
+
+static void neon_fill16(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint16_t px)
+{
+	uint16x8_t v = vdupq_n_u16(px);
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint16_t *row = (uint16_t *)(dst + j * stride);
+
+		for (i = 0; i + 8 <= w; i += 8)
+			vst1q_u16(row + i, v);
+
+		for (; i < w; i++)
+			row[i] = px;
+	}
+}
+
+static void neon_fill32(uint8_t *dst, uint32_t stride, unsigned int w, unsigned int h, uint32_t px)
+{
+	uint32x4_t v = vdupq_n_u32(px);
+	unsigned int i, j;
+
+	for (j = 0; j < h; j++) {
+		uint32_t *row = (uint32_t *)(dst + j * stride);
+
+		for (i = 0; i + 4 <= w; i += 4)
+			vst1q_u32(row + i, v);
+
+		for (; i < w; i++)
+			row[i] = px;
+	}
+}
+
+static void neon_expand16(uint8_t *dst, const uint8_t *bits, unsigned int w, uint16_t fg, uint16_t bg)
+{
+	static const uint16_t sel_bits[8] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+	uint16x8_t sel = vld1q_u16(sel_bits);
+	uint16x8_t vfg = vdupq_n_u16(fg);
+	uint16x8_t vbg = vdupq_n_u16(bg);
+	uint16_t *row = (uint16_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= w; i += 8) {
+		uint16x8_t m = vtstq_u16(vdupq_n_u16(bits[i>>3]), sel);
+
+		vst1q_u16(row + i, vbslq_u16(m, vfg, vbg));
+	}
+
+	if (i < w)
+		scalar_expand16((uint8_t *)(row + i), bits + (i>>3), w - i, fg, bg);
+}
+
+static void neon_expand32(uint8_t *dst, const uint8_t *bits, unsigned int w, uint32_t fg, uint32_t bg)
+{
+	static const uint32_t sel_hi_bits[4] = {0x80, 0x40, 0x20, 0x10};
+	static const uint32_t sel_lo_bits[4] = {0x08, 0x04, 0x02, 0x01};
+	uint32x4_t sel_hi = vld1q_u32(sel_hi_bits);
+	uint32x4_t sel_lo = vld1q_u32(sel_lo_bits);
+	uint32x4_t vfg = vdupq_n_u32(fg);
+	uint32x4_t vbg = vdupq_n_u32(bg);
+	uint32_t *row = (uint32_t *)dst;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= w; i += 8) {
+		uint32x4_t b = vdupq_n_u32(bits[i>>3]);
+
+		vst1q_u32(row + i, vbslq_u32(vtstq_u32(b, sel_hi), vfg, vbg));
+		vst1q_u32(row + i + 4, vbslq_u32(vtstq_u32(b, sel_lo), vfg, vbg));
+	}
+
+	if (i < w)
+		scalar_expand32((uint8_t *)(row + i), bits + (i>>3), w - i, fg, bg);
+}
+
+#endif /* HAVE_NEON_KERNELS */
+
+/* Ordered from the best to the worst */
+static const struct kernels kernels_tbl[] = {
+#ifdef HAVE_X86_KERNELS
+	{"avx2", avx2_supported, avx2_fill16, avx2_fill32, avx2_expand16, avx2_expand32},
+	{"sse2", sse2_supported, sse2_fill16, sse2_fill32, sse2_expand16, sse2_expand32},
+#endif
+#ifdef HAVE_NEON_KERNELS
+	{"neon", neon_supported, neon_fill16, neon_fill32, neon_expand16, neon_expand32},
+#endif
+	{"scalar", scalar_supported, scalar_fill16, scalar_fill32, scalar_expand16, scalar_expand32},
+};
+
+static const struct kernels *kernels = &kernels_tbl[GP_ARRAY_SIZE(kernels_tbl) - 1];
+
+int cell_kernels_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < GP_ARRAY_SIZE(kernels_tbl); i++) {
+		if (strcmp(kernels_tbl[i].name, name))
+			continue;
+
+		if (!kernels_tbl[i].supported())
+			return -1;
+
+		kernels = &kernels_tbl[i];
+		return 0;
+	}
+
+	return -1;
+}
+
+static void glyph_cache_init(void);
+
+void cell_kernels_init(void)
+{
+	const char *name = getenv("TERMINI_KERNELS");
+	size_t i;
+
+	glyph_cache_init();
+
+	if (name) {
+		if (!cell_kernels_select(name))
+			return;
+
+		fprintf(stderr, "Kernels '%s' not available\n", name);
+	}
+
+	for (i = 0; i < GP_ARRAY_SIZE(kernels_tbl); i++) {
+		if (kernels_tbl[i].supported()) {
+			kernels = &kernels_tbl[i];
+			return;
+		}
+	}
+}
+
+const char *cell_kernels_name(void)
+{
+	return kernels->name;
+}
+
+/*
+ * Returns pixel size in bytes if we can write the pixmap rows directly, zero
+ * otherwise.
+ */
+static unsigned int direct_bpp(const gp_pixmap *pixmap, gp_coord x, gp_coord y,
+                               gp_size w, gp_size h)
+{
+	if (pixmap->axes_swap || pixmap->x_swap || pixmap->y_swap)
+		return 0;
+
+	if (x < 0 || y < 0 || x + w > pixmap->w || y + h > pixmap->h)
+		return 0;
+
+	switch (gp_pixel_size(pixmap->pixel_type)) {
+	case 16:
+		return 2;
+	case 24:
+		return 3;
+	case 32:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static void fill_rows(uint8_t *dst, uint32_t stride, unsigned int bpp,
+                      unsigned int w, unsigned int h, gp_pixel px)
+{
+	if (!w || !h)
+		return;
+
+	switch (bpp) {
+	case 2:
+		kernels->fill16(dst, stride, w, h, px);
+	break;
+	case 3:
+		fill24(dst, stride, w, h, px);
+	break;
+	case 4:
+		kernels->fill32(dst, stride, w, h, px);
+	break;
+	}
+}
+
+static void expand_row(uint8_t *dst, const uint8_t *bits, unsigned int bpp,
+                       unsigned int w, gp_pixel fg, gp_pixel bg)
+{
+	switch (bpp) {
+	case 2:
+		kernels->expand16(dst, bits, w, fg, bg);
+	break;
+	case 3:
+		expand24(dst, bits, w, fg, bg);
+	break;
+	case 4:
+		kernels->expand32(dst, bits, w, fg, bg);
+	break;
+	}
+}
+
+void cell_fill_rect(gp_pixmap *pixmap, gp_coord x, gp_coord y,
+                    gp_size w, gp_size h, gp_pixel bg)
+{
+	unsigned int bpp = direct_bpp(pixmap, x, y, w, h);
+
+	if (!bpp) {
+		gp_fill_rect_xywh(pixmap, x, y, w, h, bg);
+		return;
+	}
+
+	fill_rows(pixmap->pixels + y * pixmap->bytes_per_row + x * bpp,
+	          pixmap->bytes_per_row, bpp, w, h, bg);
+}
+
+/*
+ * Direct mapped glyph cache, gp_get_glyph() has to look up the glyph in the
+ * font tables which is much slower than a single compare.
+ *
+ * The caches are keyed by the font and the pixel multiplier, so that each
+ * zoom level keeps its own glyphs. For multipliers bigger than one the glyphs
+ * are scaled once on a miss and stored in a per cache buffer.
+ */
+#define GLYPH_CACHE_SIZE 256
+#define GLYPH_CACHE_FONTS 8
+
+struct glyph_cache {
+	const gp_font_face *font;
+	unsigned int mul;
+	uint32_t ch[GLYPH_CACHE_SIZE];
+	gp_glyph *glyph[GLYPH_CACHE_SIZE];
+	/* Scaled glyphs, GLYPH_CACHE_SIZE slots of slot_size */
+	uint8_t *scaled;
+	size_t slot_size;
+};
+
+static struct glyph_cache glyph_caches[GLYPH_CACHE_FONTS];
+
+/* Returned for glyphs that have to be drawn by the generic code */
+static gp_glyph glyph_generic;
+
+static unsigned int scaled_bpr(const gp_font_face *font, unsigned int mul)
+{
+	return (font->max_glyph_width * mul + 7) / 8;
+}
+
+static void glyph_cache_alloc_scaled(struct glyph_cache *cache)
+{
+	const gp_font_face *font = cache->font;
+	unsigned int h = (font->ascend + font->descend) * cache->mul;
+
+	cache->slot_size = sizeof(gp_glyph) + scaled_bpr(font, cache->mul) * h;
+	cache->slot_size = (cache->slot_size + 3) & ~(size_t)3;
+
+	cache->scaled = mem_alloc(MEM_RENDER, GLYPH_CACHE_SIZE * cache->slot_size);
+}
+
+static struct glyph_cache *glyph_cache_get(const gp_font_face *font, unsigned int mul)
+{
+	static unsigned int next;
+	struct glyph_cache *cache;
+	size_t i;
+
+	for (i = 0; i < GLYPH_CACHE_FONTS; i++) {
+		if (glyph_caches[i].font == font && glyph_caches[i].mul == mul)
+			return &glyph_caches[i];
+	}
+
+	cache = &glyph_caches[next++ % GLYPH_CACHE_FONTS];
+
+	mem_free(cache->scaled);
+	cache->scaled = NULL;
+
+	cache->font = font;
+	cache->mul = mul;
+	memset(cache->glyph, 0, sizeof(cache->glyph));
+
+	if (mul > 1)
+		glyph_cache_alloc_scaled(cache);
+
+	return cache;
+}
+
+/*
+ * Scales 1bpp glyph by an integer multiplier into a cache slot.
+ */
+static gp_glyph *glyph_scale(struct glyph_cache *cache, unsigned int idx,
+                             const gp_glyph *src)
+{
+	const gp_font_face *font = cache->font;
+	unsigned int mul = cache->mul;
+	unsigned int src_bpr = (src->width + 7) / 8;
+	unsigned int dst_bpr, i, j, k;
+	gp_glyph *dst;
+
+	if (!cache->scaled)
+		return &glyph_generic;
+
+	/* Does not fit the slot, would not fit the cell either */
+	if (src->width > font->max_glyph_width ||
+	    src->height > font->ascend + font->descend ||
+	    src->width * mul > 255 || src->height * mul > 255 ||
+	    abs(src->bearing_x * (int)mul) > 127 ||
+	    abs(src->bearing_y * (int)mul) > 127)
+		return &glyph_generic;
+
+	dst = (gp_glyph *)(cache->scaled + idx * cache->slot_size);
+
+	dst->width = src->width * mul;
+	dst->height = src->height * mul;
+	dst->bearing_x = src->bearing_x * (int)mul;
+	dst->bearing_y = src->bearing_y * (int)mul;
+	dst->advance_x = GP_MIN(255u, src->advance_x * mul);
+
+	dst_bpr = (dst->width + 7) / 8;
+
+	for (j = 0; j < src->height; j++) {
+		const uint8_t *s = src->bitmap + j * src_bpr;
+		uint8_t *d = dst->bitmap + j * mul * dst_bpr;
+
+		memset(d, 0, dst_bpr);
+
+		for (i = 0; i < src->width; i++) {
+			if (!(s[i>>3] & (0x80>>(i&7))))
+				continue;
+
+			for (k = i * mul; k < (i + 1) * mul; k++)
+				d[k>>3] |= 0x80>>(k&7);
+		}
+
+		for (k = 1; k < mul; k++)
+			memcpy(d + k * dst_bpr, d, dst_bpr);
+	}
+
+	return dst;
+}
+
+static gp_glyph *glyph_lookup(const gp_font_face *font, unsigned int mul, uint32_t ch)
+{
+	struct glyph_cache *cache = glyph_cache_get(font, mul);
+	unsigned int idx = ch % GLYPH_CACHE_SIZE;
+	gp_glyph *glyph;
+
+	/*
+	 * The cache is not locked, cells are drawn either by the main or by the
+	 * render thread but never by both at once, see render_main() in
+	 * termini.c. Only the counters are read by the main thread while the
+	 * render thread draws.
+	 */
+	if (cache->glyph[idx] && cache->ch[idx] == ch) {
+		__atomic_fetch_add(&cell_kernels_stats.glyph_hits, 1, __ATOMIC_RELAXED);
+		return cache->glyph[idx];
+	}
+
+	__atomic_fetch_add(&cell_kernels_stats.glyph_misses, 1, __ATOMIC_RELAXED);
+
+	glyph = gp_get_glyph(font, ch);
+
+	if (glyph && mul > 1)
+		glyph = glyph_scale(cache, idx, glyph);
+
+	cache->ch[idx] = ch;
+	cache->glyph[idx] = glyph;
+
+	return glyph;
+}
+
+static void glyph_cache_init(void)
+{
+	mem_account_static(MEM_RENDER, sizeof(glyph_caches));
+}
+
+static int style_is_direct(const gp_text_style *style)
+{
+	return style->pixel_xmul >= 1 && style->pixel_xmul == style->pixel_ymul &&
+	       !style->pixel_xspace && !style->pixel_yspace &&
+	       style->font->glyph_bitmap_format == GP_FONT_BITMAP_1BPP;
+}
+
+static void cell_draw_glyph_generic(gp_pixmap *pixmap, const gp_text_style *style,
+                                    gp_coord x, gp_coord y, gp_size w, gp_size h,
+                                    gp_pixel fg, gp_pixel bg, uint32_t ch)
+{
+	gp_fill_rect_xywh(pixmap, x, y, w, h, bg);
+	gp_glyph_draw(pixmap, style, x, y, GP_TEXT_BEARING, fg, bg, ch);
+}
+
+void cell_draw_glyph(gp_pixmap *pixmap, const gp_text_style *style,
+                     gp_coord x, gp_coord y, gp_size w, gp_size h,
+                     gp_pixel fg, gp_pixel bg, uint32_t ch)
+{
+	unsigned int bpp = direct_bpp(pixmap, x, y, w, h);
+
+	if (!bpp || !style_is_direct(style)) {
+		cell_draw_glyph_generic(pixmap, style, x, y, w, h, fg, bg, ch);
+		return;
+	}
+
+	unsigned int mul = style->pixel_xmul;
+	gp_glyph *glyph = glyph_lookup(style->font, mul, ch);
+
+	if (!glyph) {
+		cell_fill_rect(pixmap, x, y, w, h, bg);
+		return;
+	}
+
+	int gx = glyph->bearing_x;
+	int gy = style->font->ascend * mul - glyph->bearing_y;
+
+	/* Glyph overflows the cell, let the generic code clip it */
+	if (glyph == &glyph_generic || gx < 0 || gy < 0 ||
+	    gx + glyph->width > (int)w || gy + glyph->height > (int)h) {
+		cell_draw_glyph_generic(pixmap, style, x, y, w, h, fg, bg, ch);
+		return;
+	}
+
+	uint32_t stride = pixmap->bytes_per_row;
+	uint8_t *dst = pixmap->pixels + y * stride + x * bpp;
+	unsigned int bytes_per_glyph_row = (glyph->width + 7) / 8;
+	unsigned int right = w - gx - glyph->width;
+	unsigned int j;
+
+	fill_rows(dst, stride, bpp, w, gy, bg);
+
+	for (j = 0; j < glyph->height; j++) {
+		uint8_t *row = dst + (gy + j) * stride;
+
+		fill_rows(row, stride, bpp, gx, 1, bg);
+		expand_row(row + gx * bpp, glyph->bitmap + j * bytes_per_glyph_row,
+		           bpp, glyph->width, fg, bg);
+		fill_rows(row + (gx + glyph->width) * bpp, stride, bpp, right, 1, bg);
+	}
+
+	fill_rows(dst + (gy + glyph->height) * stride, stride, bpp,
+	          w, h - gy - glyph->height, bg);
+}
+
+int cell_move_rows(gp_pixmap *pixmap, gp_coord dst_y, gp_coord src_y, gp_size h)
+{
+	uint32_t stride = pixmap->bytes_per_row;
+
+	if (pixmap->axes_swap || pixmap->x_swap || pixmap->y_swap)
+		return -1;
+
+	if (dst_y < 0 || src_y < 0 ||
+	    dst_y + h > pixmap->h || src_y + h > pixmap->h)
+		return -1;
+
+	memmove(pixmap->pixels + dst_y * stride,
+	        pixmap->pixels + src_y * stride, (size_t)h * stride);
+
+	return 0;
+}
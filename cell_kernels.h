@@ -0,0 +1,74 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Cell background fill and 1bpp glyph expansion kernels.
+
+   The kernels write directly into the pixmap rows for 16, 24 and 32 bit
+   pixel types, everything else (sub-byte pixels, rotated pixmaps, uneven pixel
+   multipliers or antialiased fonts) falls back to the generic gfxprim
+   functions. Fonts with integer pixel multipliers are scaled once per glyph
+   and cached per size.
+
+  */
+
+#ifndef CELL_KERNELS_H
+#define CELL_KERNELS_H
+
+#include <stdint.h>
+#include <gfxprim.h>
+
+struct cell_kernels_stats {
+	unsigned long glyph_hits;
+	unsigned long glyph_misses;
+};
+
+extern struct cell_kernels_stats cell_kernels_stats;
+
+/*
+ * Picks the best kernels for the CPU we are running on.
+ *
+ * The TERMINI_KERNELS environment variable can be set to one of "scalar",
+ * "sse2", "avx2" or "neon" to override the autodetection.
+ */
+void cell_kernels_init(void);
+
+/*
+ * Selects kernels by name, returns 0 on success, -1 if the kernels are not
+ * compiled in or not supported by the CPU.
+ */
+int cell_kernels_select(const char *name);
+
+/*
+ * Returns name of the kernels in use.
+ */
+const char *cell_kernels_name(void);
+
+/*
+ * Fills a cell rectangle with a background color.
+ */
+void cell_fill_rect(gp_pixmap *pixmap, gp_coord x, gp_coord y,
+                    gp_size w, gp_size h, gp_pixel bg);
+
+/*
+ * Draws a cell, i.e. background and the glyph, in a single pass.
+ *
+ * The glyph is placed the same way as gp_glyph_draw() with GP_TEXT_BEARING
+ * would do.
+ */
+void cell_draw_glyph(gp_pixmap *pixmap, const gp_text_style *style,
+                     gp_coord x, gp_coord y, gp_size w, gp_size h,
+                     gp_pixel fg, gp_pixel bg, uint32_t ch);
+
+/*
+ * Moves whole pixmap rows, the source and destination may overlap.
+ *
+ * Returns 0 on success, -1 if the pixmap is rotated or the rows are out of
+ * the pixmap.
+ */
+int cell_move_rows(gp_pixmap *pixmap, gp_coord dst_y, gp_coord src_y, gp_size h);
+
+#endif /* CELL_KERNELS_H */
@@ -17,3 +17,39 @@ if [ $? -ne 0 ]; then
 else
 	echo "#define HAVE_COLOR_INDEXED 1" >> config.h
 fi
+
+echo "# Generated file do not touch" > config.mk
+
+gcc  -o /dev/null -x c - -luring > /dev/null 2>&1 << EOF
+#include <liburing.h>
+int main(void)
+{
+	struct io_uring ring;
+	int ret;
+	io_uring_queue_init(8, &ring, 0);
+	io_uring_setup_buf_ring(&ring, 8, 0, 0, &ret);
+	io_uring_prep_read_multishot(io_uring_get_sqe(&ring), 0, 0, 0, 0);
+	return 0;
+}
+EOF
+
+if [ $? -ne 0 ]; then
+	echo "// HAVE_LIBURING is not set" >> config.h
+else
+	echo "#define HAVE_LIBURING 1" >> config.h
+	echo "LDLIBS_URING=-luring" >> config.mk
+fi
+
+gcc $(gfxprim-config --cflags) -o /dev/null -x c - > /dev/null 2>&1 << EOF
+#include <gfxprim.h>
+int main(void)
+{
+	return GP_EV_SYS_VISIBILITY;
+}
+EOF
+
+if [ $? -ne 0 ]; then
+	echo "// HAVE_EV_SYS_VISIBILITY is not set" >> config.h
+else
+	echo "#define HAVE_EV_SYS_VISIBILITY 1" >> config.h
+fi
@@ -0,0 +1,289 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "cell_kernels.h"
+#include "stats.h"
+#include "control.h"
+
+#define CONTROL_CLIENTS 4
+#define CONTROL_LINE_MAX 128
+#define CONTROL_REPLY_MAX 4096
+
+struct client {
+	gp_fd pfd;
+	int used;
+	size_t len;
+	char buf[CONTROL_LINE_MAX];
+};
+
+static gp_backend *backend;
+static gp_fd listen_pfd = {.fd = -1};
+static struct client clients[CONTROL_CLIENTS];
+static char sock_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/* Opened on the first command and kept so that replies do not allocate */
+static char reply[CONTROL_REPLY_MAX];
+static FILE *reply_f;
+
+/*
+ * Called from the client callback, the fd is removed from the poll by
+ * returning GP_POLL_RET_REMOVE.
+ */
+static enum gp_poll_event_ret client_drop(struct client *client)
+{
+	close(client->pfd.fd);
+	client->used = 0;
+
+	return GP_POLL_RET_REMOVE;
+}
+
+static void cmd_stats(FILE *f)
+{
+	stats_dump(f);
+	fprintf(f, "glyph_hits %lu\n", cell_kernels_stats.glyph_hits);
+	fprintf(f, "glyph_misses %lu\n", cell_kernels_stats.glyph_misses);
+}
+
+static void cmd_reset(FILE *f)
+{
+	stats_reset();
+	memset(&cell_kernels_stats, 0, sizeof(cell_kernels_stats));
+	fprintf(f, "ok\n");
+}
+
+static void cmd_help(FILE *f)
+{
+	fprintf(f, "stats\nreset\ntrace on|off\nhelp\n");
+}
+
+static void process_line(char *line, FILE *f)
+{
+	if (!strcmp(line, "stats")) {
+		cmd_stats(f);
+	} else if (!strcmp(line, "reset")) {
+		cmd_reset(f);
+	} else if (!strcmp(line, "trace on")) {
+		stats_tracing = 1;
+		fprintf(f, "ok\n");
+	} else if (!strcmp(line, "trace off")) {
+		stats_tracing = 0;
+		fprintf(f, "ok\n");
+	} else if (!strcmp(line, "help")) {
+		cmd_help(f);
+	} else if (line[0]) {
+		fprintf(f, "error unknown command\n");
+	}
+
+	fprintf(f, "\n");
+}
+
+/*
+ * Answers a command, the reply is small enough to fit into the socket buffer
+ * so a client that does not read its replies is disconnected.
+ */
+static int client_reply(struct client *client, char *line)
+{
+	ssize_t len;
+
+	if (!reply_f) {
+		reply_f = fmemopen(reply, sizeof(reply), "w");
+		if (!reply_f)
+			return -1;
+
+		/* Writes go straight into the reply buffer */
+		setvbuf(reply_f, NULL, _IONBF, 0);
+	}
+
+	rewind(reply_f);
+	process_line(line, reply_f);
+
+	len = ftell(reply_f);
+
+	if (len >= (ssize_t)sizeof(reply))
+		len = sizeof(reply) - 1;
+
+	return send(client->pfd.fd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+static enum gp_poll_event_ret client_event(gp_fd *self)
+{
+	struct client *client = self->priv;
+	char *nl;
+	ssize_t ret;
+
+	ret = recv(self->fd, client->buf + client->len,
+	           sizeof(client->buf) - client->len, MSG_DONTWAIT);
+
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return GP_POLL_RET_OK;
+
+	if (ret <= 0)
+		return client_drop(client);
+
+	client->len += ret;
+
+	while ((nl = memchr(client->buf, '\n', client->len))) {
+		size_t line_len = nl - client->buf;
+
+		*nl = 0;
+
+		if (line_len && nl[-1] == '\r')
+			nl[-1] = 0;
+
+		if (client_reply(client, client->buf))
+			return client_drop(client);
+
+		client->len -= line_len + 1;
+		memmove(client->buf, nl + 1, client->len);
+	}
+
+	/* Line does not fit the buffer */
+	if (client->len == sizeof(client->buf))
+		return client_drop(client);
+
+	return GP_POLL_RET_OK;
+}
+
+static enum gp_poll_event_ret listen_event(gp_fd *self)
+{
+	unsigned int i;
+	int fd;
+
+	fd = accept4(self->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return GP_POLL_RET_OK;
+
+	for (i = 0; i < CONTROL_CLIENTS; i++) {
+		if (!clients[i].used)
+			break;
+	}
+
+	if (i == CONTROL_CLIENTS) {
+		close(fd);
+		return GP_POLL_RET_OK;
+	}
+
+	clients[i].len = 0;
+	clients[i].used = 1;
+	clients[i].pfd = (gp_fd) {
+		.fd = fd,
+		.event = client_event,
+		.events = GP_POLLIN,
+		.priv = &clients[i],
+	};
+
+	gp_backend_poll_add(backend, &clients[i].pfd);
+
+	return GP_POLL_RET_OK;
+}
+
+int control_init(gp_backend *b, const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	struct stat st;
+	mode_t mask;
+	int fd, ret;
+
+	if (!dir || !dir[0])
+		dir = "/tmp";
+
+	if (path)
+		ret = snprintf(sock_path, sizeof(sock_path), "%s", path);
+	else
+		ret = snprintf(sock_path, sizeof(sock_path), "%s/termini-%i.sock", dir, getpid());
+
+	if (ret >= (int)sizeof(sock_path)) {
+		fprintf(stderr, "Control socket path too long\n");
+		sock_path[0] = 0;
+		return -1;
+	}
+
+	/* Only a stale socket is removed, never a file passed by mistake */
+	if (!lstat(sock_path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "Control socket path %s exists and is not a socket\n",
+			        sock_path);
+			sock_path[0] = 0;
+			return -1;
+		}
+
+		unlink(sock_path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create control socket: %s\n", strerror(errno));
+		sock_path[0] = 0;
+		return -1;
+	}
+
+	memcpy(addr.sun_path, sock_path, sizeof(sock_path));
+
+	/* The counters are readable by the owner only */
+	mask = umask(0077);
+	ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+
+	if (ret || listen(fd, CONTROL_CLIENTS)) {
+		fprintf(stderr, "Failed to bind control socket %s: %s\n",
+		        sock_path, strerror(errno));
+		close(fd);
+		sock_path[0] = 0;
+		return -1;
+	}
+
+	backend = b;
+
+	listen_pfd = (gp_fd) {
+		.fd = fd,
+		.event = listen_event,
+		.events = GP_POLLIN,
+	};
+
+	gp_backend_poll_add(backend, &listen_pfd);
+
+	fprintf(stderr, "Control socket %s\n", sock_path);
+
+	return 0;
+}
+
+void control_exit(void)
+{
+	unsigned int i;
+
+	if (listen_pfd.fd < 0)
+		return;
+
+	for (i = 0; i < CONTROL_CLIENTS; i++) {
+		if (!clients[i].used)
+			continue;
+
+		gp_backend_poll_rem(backend, &clients[i].pfd);
+		close(clients[i].pfd.fd);
+		clients[i].used = 0;
+	}
+
+	gp_backend_poll_rem(backend, &listen_pfd);
+	close(listen_pfd.fd);
+	listen_pfd.fd = -1;
+
+	unlink(sock_path);
+
+	if (reply_f) {
+		fclose(reply_f);
+		reply_f = NULL;
+	}
+}
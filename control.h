@@ -0,0 +1,41 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Local control socket.
+
+   A UNIX domain stream socket that answers line based queries, it's served
+   from the backend poll loop along with the PTY. Each command is answered
+   with zero or more lines and terminated by an empty line.
+
+   Commands:
+
+   stats         counters as name value pairs
+   reset         zeroes the counters
+   trace on|off  toggles trace messages on stderr
+   help          lists the commands
+
+  */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <gfxprim.h>
+
+/*
+ * Creates the socket and adds it to the backend poll loop, the default path
+ * is $XDG_RUNTIME_DIR/termini-<pid>.sock.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int control_init(gp_backend *backend, const char *path);
+
+/*
+ * Closes all connections and removes the socket.
+ */
+void control_exit(void);
+
+#endif /* CONTROL_H */
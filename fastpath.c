@@ -0,0 +1,317 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+#endif
+
+#include "fastpath.h"
+
+enum parser_state {
+	ST_GROUND,
+	ST_ESC,
+	ST_CSI,
+	ST_OSC,
+	/* DCS, SOS, PM and APC, terminated by ST only */
+	ST_STRING,
+};
+
+static enum parser_state state;
+
+/* First intermediate byte of an escape sequence */
+static uint8_t esc_inter;
+
+/* CSI private marker, intermediate and the parameter being parsed */
+static uint8_t csi_priv;
+static uint8_t csi_inter;
+static unsigned int csi_param;
+static int csi_irm;
+static int csi_lrmm;
+
+/* Character set and mode state that changes how ASCII is printed */
+static int g0_ascii = 1;
+static int gl_shifted;
+static int single_shift;
+static int insert_mode;
+static int lr_margins;
+
+/* Continuation bytes left in the UTF-8 sequence */
+static int utf8_left;
+
+void fastpath_reset(void)
+{
+	state = ST_GROUND;
+	g0_ascii = 1;
+	gl_shifted = 0;
+	single_shift = 0;
+	insert_mode = 0;
+	lr_margins = 0;
+	utf8_left = 0;
+}
+
+static int printable(uint8_t c)
+{
+	return c >= 0x20 && c < 0x7f;
+}
+
+/*
+ * Returns the length of the printable ASCII prefix.
+ */
+static size_t printable_len(const char *buf, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(0x20);
+	const __m128i del = _mm_set1_epi8(0x7f);
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		/* Signed compare catches the bytes with the top bit set as well */
+		__m128i bad = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+		int mask = _mm_movemask_epi8(bad);
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t space = vdupq_n_u8(0x20);
+	const uint8x16_t tilde = vdupq_n_u8(0x7e);
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)(buf + i));
+		uint8x16_t ok = vandq_u8(vcgeq_u8(v, space), vcleq_u8(v, tilde));
+
+		if (vminvq_u8(ok) != 0xff)
+			break;
+	}
+#endif
+
+	while (i < len && printable(buf[i]))
+		i++;
+
+	return i;
+}
+
+static void csi_param_end(void)
+{
+	if (!csi_priv && csi_param == 4)
+		csi_irm = 1;
+
+	if (csi_priv == '?' && csi_param == 69)
+		csi_lrmm = 1;
+
+	csi_param = 0;
+}
+
+static void csi_final(uint8_t c)
+{
+	csi_param_end();
+
+	/* DECSTR soft reset */
+	if (csi_inter == '!' && c == 'p') {
+		fastpath_reset();
+		return;
+	}
+
+	if (csi_inter || (c != 'h' && c != 'l'))
+		return;
+
+	if (csi_irm)
+		insert_mode = c == 'h';
+
+	if (csi_lrmm)
+		lr_margins = c == 'h';
+}
+
+static void esc_final(uint8_t c)
+{
+	state = ST_GROUND;
+
+	if (esc_inter) {
+		if (esc_inter == '(')
+			g0_ascii = c == 'B';
+		return;
+	}
+
+	switch (c) {
+	case '[':
+		state = ST_CSI;
+		csi_priv = 0;
+		csi_inter = 0;
+		csi_param = 0;
+		csi_irm = 0;
+		csi_lrmm = 0;
+	break;
+	case ']':
+		state = ST_OSC;
+	break;
+	case 'P':
+	case 'X':
+	case '^':
+	case '_':
+		state = ST_STRING;
+	break;
+	/* RIS */
+	case 'c':
+		fastpath_reset();
+	break;
+	/* LS2 and LS3 */
+	case 'n':
+	case 'o':
+		gl_shifted = 1;
+	break;
+	/* SS2 and SS3 */
+	case 'N':
+	case 'O':
+		single_shift = 1;
+	break;
+	}
+}
+
+/*
+ * Control characters are executed in the middle of sequences as well.
+ */
+static void control_byte(uint8_t c)
+{
+	if (c == 0x0e)
+		gl_shifted = 1;
+
+	if (c == 0x0f)
+		gl_shifted = 0;
+}
+
+static void ground_byte(uint8_t c)
+{
+	if (c < 0x20 || c == 0x7f) {
+		utf8_left = 0;
+		control_byte(c);
+
+		if (c == 0x1b) {
+			state = ST_ESC;
+			esc_inter = 0;
+		}
+
+		return;
+	}
+
+	single_shift = 0;
+
+	if (c < 0x80) {
+		utf8_left = 0;
+		return;
+	}
+
+	if (c < 0xc0) {
+		if (utf8_left)
+			utf8_left--;
+		return;
+	}
+
+	if (c < 0xe0)
+		utf8_left = 1;
+	else if (c < 0xf0)
+		utf8_left = 2;
+	else if (c < 0xf8)
+		utf8_left = 3;
+	else
+		utf8_left = 0;
+}
+
+/*
+ * Feeds one byte outside of a run to the mirrored parser.
+ */
+static void parse_byte(uint8_t c)
+{
+	if (state != ST_GROUND) {
+		/* CAN and SUB abort any sequence */
+		if (c == 0x18 || c == 0x1a) {
+			state = ST_GROUND;
+			return;
+		}
+
+		if (c == 0x1b) {
+			state = ST_ESC;
+			esc_inter = 0;
+			return;
+		}
+	}
+
+	switch (state) {
+	case ST_GROUND:
+		ground_byte(c);
+	break;
+	case ST_ESC:
+		if (c < 0x20) {
+			control_byte(c);
+		} else if (c >= 0x20 && c < 0x30) {
+			if (!esc_inter)
+				esc_inter = c;
+		} else if (c >= 0x30 && c < 0x7f) {
+			esc_final(c);
+		}
+	break;
+	case ST_CSI:
+		if (c < 0x20) {
+			control_byte(c);
+		} else if (c >= '0' && c <= '9') {
+			if (csi_param < 100000)
+				csi_param = csi_param * 10 + c - '0';
+		} else if (c == ';' || c == ':') {
+			csi_param_end();
+		} else if (c >= 0x3c && c < 0x40) {
+			csi_priv = c;
+		} else if (c >= 0x20 && c < 0x30) {
+			csi_inter = c;
+		} else if (c >= 0x40 && c < 0x7f) {
+			csi_final(c);
+			state = ST_GROUND;
+		}
+	break;
+	case ST_OSC:
+		if (c == 0x07)
+			state = ST_GROUND;
+	break;
+	case ST_STRING:
+	break;
+	}
+}
+
+static int run_allowed(void)
+{
+	return state == ST_GROUND && g0_ascii && !gl_shifted && !single_shift &&
+	       !insert_mode && !lr_margins && !utf8_left;
+}
+
+size_t fastpath_scan(const char *buf, size_t len, size_t *run_len)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		if (run_allowed() && printable(buf[i])) {
+			size_t run = printable_len(buf + i, len - i);
+
+			if (run >= FASTPATH_RUN_MIN) {
+				*run_len = run;
+				return i;
+			}
+
+			i += run;
+			continue;
+		}
+
+		parse_byte(buf[i++]);
+	}
+
+	*run_len = 0;
+
+	return len;
+}
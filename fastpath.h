@@ -0,0 +1,44 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Printable ASCII run detection ahead of libvterm.
+
+   Mirrors just enough of the libvterm parser state to tell where printable
+   ASCII would be printed as it is, that is in the ground state, with the G0
+   ASCII character set mapped to GL, no single shift pending, insert mode and
+   left/right margins disabled. Everything else, escape sequences, control
+   characters, strings and non-ASCII, has to be passed to libvterm so that the
+   mirrored state stays in sync.
+
+   The run end is searched for 16 bytes at a time with SSE2 or NEON.
+
+  */
+
+#ifndef FASTPATH_H
+#define FASTPATH_H
+
+#include <stddef.h>
+
+/* Shorter runs are passed to libvterm */
+#define FASTPATH_RUN_MIN 8
+
+/*
+ * Scans the buffer up to the next run of printable ASCII that can be written
+ * directly, the parser state is carried over between calls.
+ *
+ * Returns the number of bytes that have to be passed to libvterm first, the
+ * run length is stored into run_len and is zero when there is no run in the
+ * buffer.
+ */
+size_t fastpath_scan(const char *buf, size_t len, size_t *run_len);
+
+/*
+ * Resets the mirrored state, has to be called along with the libvterm reset.
+ */
+void fastpath_reset(void);
+
+#endif /* FASTPATH_H */
@@ -0,0 +1,712 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gfxprim.h>
+
+#include "config.h"
+#include "mem.h"
+#include "grid.h"
+
+struct grid_buf {
+	struct grid_cell *cells;
+	struct grid_cell **rows;
+};
+
+static struct grid_buf bufs[2];
+static struct grid_buf *cur;
+static struct grid_cell **tmp_rows;
+static int alt_enabled;
+
+/*
+ * Each row is preceded by a header cell that holds the row flags, that way the
+ * flags move along with the row pointers when the screen is scrolled.
+ */
+#define ROW_SHARED 0x01
+#define ROW_ORPHAN 0x02
+
+/* Spare rows for copy-on-write, used as a stack */
+static struct grid_buf spare;
+static int spare_cnt;
+
+static int snap_enabled;
+static struct grid_cell **snap_rows;
+static int snap_start, snap_end;
+
+static int rows, cols;
+
+static struct grid_cell pen;
+static struct grid_cell blank;
+
+static const struct grid_callbacks *cbs;
+
+struct grid_cell **grid_row;
+
+static void damage(int start_row, int end_row, int start_col, int end_col)
+{
+	VTermRect rect = {
+		.start_row = start_row,
+		.end_row = end_row,
+		.start_col = start_col,
+		.end_col = end_col,
+	};
+
+	cbs->damage(rect, NULL);
+}
+
+static uint32_t *row_flags(struct grid_cell *row)
+{
+	return &row[-1].ch;
+}
+
+static int buf_alloc(struct grid_buf *buf, int new_rows, int new_cols)
+{
+	int row;
+
+	buf->cells = mem_alloc(MEM_GRID, sizeof(struct grid_cell) * new_rows * (new_cols + 1));
+	buf->rows = mem_alloc(MEM_GRID, sizeof(struct grid_cell *) * new_rows);
+
+	if (!buf->cells || !buf->rows) {
+		mem_free(buf->cells);
+		mem_free(buf->rows);
+		return -1;
+	}
+
+	for (row = 0; row < new_rows; row++) {
+		int col;
+
+		buf->rows[row] = buf->cells + row * (new_cols + 1) + 1;
+
+		for (col = 0; col < new_cols; col++)
+			buf->rows[row][col] = blank;
+	}
+
+	return 0;
+}
+
+static void buf_free(struct grid_buf *buf)
+{
+	mem_free(buf->cells);
+	mem_free(buf->rows);
+
+	buf->cells = NULL;
+	buf->rows = NULL;
+}
+
+static void set_cur(struct grid_buf *buf)
+{
+	cur = buf;
+	grid_row = buf->rows;
+}
+
+/*
+ * Returns the row for writing, rows shared with a snapshot are copied first.
+ */
+static struct grid_cell *row_write(int row)
+{
+	struct grid_cell *old = cur->rows[row];
+	struct grid_cell *new;
+
+	if (!(*row_flags(old) & ROW_SHARED))
+		return old;
+
+	new = spare.rows[--spare_cnt];
+	memcpy(new, old, sizeof(struct grid_cell) * cols);
+	*row_flags(new) = 0;
+	*row_flags(old) |= ROW_ORPHAN;
+	cur->rows[row] = new;
+
+	return new;
+}
+
+static void erase_cells(int row, int start_col, int end_col)
+{
+	struct grid_cell cell = {.fg = pen.fg, .bg = pen.bg};
+	struct grid_cell *cells = row_write(row);
+	int col;
+
+	for (col = start_col; col < end_col; col++)
+		cells[col] = cell;
+}
+
+static int grid_erase(VTermRect rect, int selective, void *user)
+{
+	int row;
+
+	(void)selective;
+	(void)user;
+
+	for (row = rect.start_row; row < rect.end_row; row++)
+		erase_cells(row, rect.start_col, rect.end_col);
+
+	cbs->damage(rect, NULL);
+
+	return 1;
+}
+
+static int grid_putglyph(VTermGlyphInfo *info, VTermPos pos, void *user)
+{
+	struct grid_cell *cell = &row_write(pos.row)[pos.col];
+	int i;
+
+	(void)user;
+
+	cell->ch = (info->chars[0] & GRID_CH_MASK) | pen.ch;
+	cell->fg = pen.fg;
+	cell->bg = pen.bg;
+
+	if (info->width > 1)
+		cell->ch |= GRID_WIDE;
+
+	for (i = 1; i < info->width && pos.col + i < cols; i++) {
+		cell[i].ch = GRID_CONT | pen.ch;
+		cell[i].fg = pen.fg;
+		cell[i].bg = pen.bg;
+	}
+
+	damage(pos.row, pos.row + 1, pos.col, pos.col + i);
+
+	return 1;
+}
+
+static int grid_moverect(VTermRect dest, VTermRect src, void *user)
+{
+	size_t size = sizeof(struct grid_cell) * (dest.end_col - dest.start_col);
+	int i, h = dest.end_row - dest.start_row;
+
+	(void)user;
+
+	if (dest.start_row <= src.start_row) {
+		for (i = 0; i < h; i++) {
+			memmove(&row_write(dest.start_row + i)[dest.start_col],
+			        &cur->rows[src.start_row + i][src.start_col], size);
+		}
+	} else {
+		for (i = h - 1; i >= 0; i--) {
+			memmove(&row_write(dest.start_row + i)[dest.start_col],
+			        &cur->rows[src.start_row + i][src.start_col], size);
+		}
+	}
+
+	cbs->damage(dest, NULL);
+
+	return 1;
+}
+
+/*
+ * Full width scroll, rotates the row pointers.
+ */
+static void rotate_rows(int start_row, int end_row, int downward)
+{
+	size_t ptr = sizeof(struct grid_cell *);
+	int h = end_row - start_row;
+	int row;
+
+	if (downward > 0) {
+		memcpy(tmp_rows, &cur->rows[start_row], downward * ptr);
+		memmove(&cur->rows[start_row], &cur->rows[start_row + downward],
+		        (h - downward) * ptr);
+		memcpy(&cur->rows[end_row - downward], tmp_rows, downward * ptr);
+
+		for (row = end_row - downward; row < end_row; row++)
+			erase_cells(row, 0, cols);
+	} else {
+		downward = -downward;
+
+		memcpy(tmp_rows, &cur->rows[end_row - downward], downward * ptr);
+		memmove(&cur->rows[start_row + downward], &cur->rows[start_row],
+		        (h - downward) * ptr);
+		memcpy(&cur->rows[start_row], tmp_rows, downward * ptr);
+
+		for (row = start_row; row < start_row + downward; row++)
+			erase_cells(row, 0, cols);
+	}
+}
+
+static int grid_scrollrect(VTermRect rect, int downward, int rightward, void *user)
+{
+	int h = rect.end_row - rect.start_row;
+	int w = rect.end_col - rect.start_col;
+	int row;
+
+	(void)user;
+
+	if (abs(downward) >= h || abs(rightward) >= w) {
+		grid_erase(rect, 0, NULL);
+		return 1;
+	}
+
+	/* Lines scrolled off the top of the primary screen go to the scrollback */
+	if (downward > 0 && rect.start_row == 0 && rect.start_col == 0 &&
+	    rect.end_col == cols && cur == &bufs[0] && cbs->sb_pushline) {
+		for (row = 0; row < downward; row++)
+			cbs->sb_pushline(cols, cur->rows[row], NULL);
+	}
+
+	if (!rightward && rect.start_col == 0 && rect.end_col == cols) {
+		rotate_rows(rect.start_row, rect.end_row, downward);
+		cbs->damage(rect, NULL);
+		return 1;
+	}
+
+	VTermRect src = rect, dest = rect, erase = rect;
+
+	if (downward >= 0) {
+		src.start_row += downward;
+		dest.end_row -= downward;
+	} else {
+		src.end_row += downward;
+		dest.start_row -= downward;
+	}
+
+	if (rightward >= 0) {
+		src.start_col += rightward;
+		dest.end_col -= rightward;
+	} else {
+		src.end_col += rightward;
+		dest.start_col -= rightward;
+	}
+
+	grid_moverect(dest, src, NULL);
+
+	if (downward > 0) {
+		erase.start_row = rect.end_row - downward;
+		grid_erase(erase, 0, NULL);
+	} else if (downward < 0) {
+		erase.end_row = rect.start_row - downward;
+		grid_erase(erase, 0, NULL);
+	}
+
+	erase = rect;
+
+	if (rightward > 0) {
+		erase.start_col = rect.end_col - rightward;
+		grid_erase(erase, 0, NULL);
+	} else if (rightward < 0) {
+		erase.end_col = rect.start_col - rightward;
+		grid_erase(erase, 0, NULL);
+	}
+
+	return 1;
+}
+
+static int grid_movecursor(VTermPos pos, VTermPos oldpos, int visible, void *user)
+{
+	return cbs->movecursor(pos, oldpos, visible, user);
+}
+
+/*
+ * Maps 24-bit color to the closest color in the xterm 6x6x6 cube.
+ */
+static uint8_t rgb_to_idx(uint8_t r, uint8_t g, uint8_t b)
+{
+	uint8_t c[3] = {r, g, b};
+	int i;
+
+	for (i = 0; i < 3; i++)
+		c[i] = c[i] < 48 ? 0 : c[i] < 115 ? 1 : (c[i] - 35) / 40;
+
+	return 16 + 36 * c[0] + 6 * c[1] + c[2];
+}
+
+static uint8_t color_idx(const VTermColor *col)
+{
+#ifdef HAVE_COLOR_INDEXED
+	if (VTERM_COLOR_IS_RGB(col))
+		return rgb_to_idx(col->rgb.red, col->rgb.green, col->rgb.blue);
+
+	return col->indexed.idx;
+#else
+	return col->red;
+#endif
+}
+
+static void pen_attr(uint32_t attr, int set)
+{
+	if (set)
+		pen.ch |= attr;
+	else
+		pen.ch &= ~attr;
+}
+
+static int grid_setpenattr(VTermAttr attr, VTermValue *val, void *user)
+{
+	(void)user;
+
+	switch (attr) {
+	case VTERM_ATTR_BOLD:
+		pen_attr(GRID_BOLD, val->boolean);
+	break;
+	case VTERM_ATTR_UNDERLINE:
+		pen_attr(GRID_UNDERLINE, val->number);
+	break;
+	case VTERM_ATTR_ITALIC:
+		pen_attr(GRID_ITALIC, val->boolean);
+	break;
+	case VTERM_ATTR_BLINK:
+		pen_attr(GRID_BLINK, val->boolean);
+	break;
+	case VTERM_ATTR_REVERSE:
+		pen_attr(GRID_REVERSE, val->boolean);
+	break;
+	case VTERM_ATTR_CONCEAL:
+		pen_attr(GRID_CONCEAL, val->boolean);
+	break;
+	case VTERM_ATTR_STRIKE:
+		pen_attr(GRID_STRIKE, val->boolean);
+	break;
+	case VTERM_ATTR_FOREGROUND:
+		pen.fg = color_idx(&val->color);
+	break;
+	case VTERM_ATTR_BACKGROUND:
+		pen.bg = color_idx(&val->color);
+	break;
+	default:
+	break;
+	}
+
+	return 1;
+}
+
+static int grid_initpen(void *user)
+{
+	(void)user;
+
+	pen = blank;
+
+	return 1;
+}
+
+static int grid_settermprop(VTermProp prop, VTermValue *val, void *user)
+{
+	if (prop == VTERM_PROP_ALTSCREEN) {
+		if (!alt_enabled)
+			return 0;
+
+		set_cur(val->boolean ? &bufs[1] : &bufs[0]);
+
+		/* Enabling is followed by an erase that damages the screen */
+		if (!val->boolean)
+			damage(0, rows, 0, cols);
+	}
+
+	return cbs->settermprop(prop, val, user);
+}
+
+static int grid_bell(void *user)
+{
+	return cbs->bell(user);
+}
+
+/*
+ * Copies the old content, when the number of rows shrinks the top lines are
+ * dropped so that the cursor stays on the screen.
+ */
+static void buf_copy(struct grid_buf *dst, struct grid_buf *src, int new_rows,
+                     int new_cols, int shift)
+{
+	int row, copy_rows = GP_MIN(new_rows, rows - shift);
+	int copy_cols = GP_MIN(new_cols, cols);
+
+	for (row = 0; row < copy_rows; row++) {
+		memcpy(dst->rows[row], src->rows[row + shift],
+		       sizeof(struct grid_cell) * copy_cols);
+	}
+}
+
+static int grid_resize(int new_rows, int new_cols, VTermStateFields *fields, void *user)
+{
+	struct grid_buf new_bufs[2] = {}, new_spare = {};
+	struct grid_cell **new_tmp, **new_snap = NULL;
+	int shift = GP_MAX(0, fields->pos.row + 1 - new_rows);
+	int i, row;
+
+	(void)user;
+
+	new_tmp = mem_alloc(MEM_GRID, sizeof(struct grid_cell *) * new_rows);
+
+	if (snap_enabled) {
+		new_snap = mem_alloc(MEM_GRID, sizeof(struct grid_cell *) * new_rows);
+		if (!new_snap || buf_alloc(&new_spare, new_rows, new_cols))
+			new_tmp = NULL;
+	}
+
+	if (!new_tmp || buf_alloc(&new_bufs[0], new_rows, new_cols) ||
+	    (alt_enabled && buf_alloc(&new_bufs[1], new_rows, new_cols))) {
+		fprintf(stderr, "Failed to allocate %ix%i grid\n", new_cols, new_rows);
+		exit(1);
+	}
+
+	if (cur == &bufs[0] && cbs->sb_pushline) {
+		for (row = 0; row < shift; row++)
+			cbs->sb_pushline(cols, bufs[0].rows[row], NULL);
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (bufs[i].cells && new_bufs[i].cells)
+			buf_copy(&new_bufs[i], &bufs[i], new_rows, new_cols, shift);
+	}
+
+	/* Rows may have been swapped between the buffers by copy-on-write */
+	for (i = 0; i < 2; i++) {
+		if (!bufs[i].cells || !new_bufs[i].cells)
+			continue;
+
+		buf_free(&bufs[i]);
+		bufs[i] = new_bufs[i];
+	}
+
+	if (snap_enabled) {
+		buf_free(&spare);
+		spare = new_spare;
+		spare_cnt = new_rows;
+		mem_free(snap_rows);
+		snap_rows = new_snap;
+	}
+
+	mem_free(tmp_rows);
+	tmp_rows = new_tmp;
+
+	set_cur(cur);
+
+	fields->pos.row -= shift;
+
+	rows = new_rows;
+	cols = new_cols;
+
+	damage(0, rows, 0, cols);
+
+	return 1;
+}
+
+static int grid_setlineinfo(int row, const VTermLineInfo *newinfo,
+                            const VTermLineInfo *oldinfo, void *user)
+{
+	(void)row;
+	(void)newinfo;
+	(void)oldinfo;
+	(void)user;
+
+	return 1;
+}
+
+static const VTermStateCallbacks state_callbacks = {
+	.putglyph = grid_putglyph,
+	.movecursor = grid_movecursor,
+	.scrollrect = grid_scrollrect,
+	.moverect = grid_moverect,
+	.erase = grid_erase,
+	.initpen = grid_initpen,
+	.setpenattr = grid_setpenattr,
+	.settermprop = grid_settermprop,
+	.bell = grid_bell,
+	.resize = grid_resize,
+	.setlineinfo = grid_setlineinfo,
+};
+
+int grid_init(VTerm *vt, int altscreen, const struct grid_callbacks *callbacks,
+              uint8_t default_fg, uint8_t default_bg)
+{
+	VTermState *vs = vterm_obtain_state(vt);
+
+	cbs = callbacks;
+	alt_enabled = altscreen;
+
+	blank.ch = 0;
+	blank.fg = default_fg;
+	blank.bg = default_bg;
+	pen = blank;
+
+	vterm_get_size(vt, &rows, &cols);
+
+	tmp_rows = mem_alloc(MEM_GRID, sizeof(struct grid_cell *) * rows);
+	if (!tmp_rows)
+		return -1;
+
+	if (buf_alloc(&bufs[0], rows, cols))
+		return -1;
+
+	if (alt_enabled && buf_alloc(&bufs[1], rows, cols))
+		return -1;
+
+	set_cur(&bufs[0]);
+
+	vterm_state_set_callbacks(vs, &state_callbacks, NULL);
+
+	return 0;
+}
+
+void grid_exit(void)
+{
+	buf_free(&bufs[0]);
+	buf_free(&bufs[1]);
+	buf_free(&spare);
+	mem_free(tmp_rows);
+	mem_free(snap_rows);
+	tmp_rows = NULL;
+	snap_rows = NULL;
+	snap_enabled = 0;
+}
+
+int grid_snapshot_init(void)
+{
+	snap_rows = mem_alloc(MEM_GRID, sizeof(struct grid_cell *) * rows);
+	if (!snap_rows)
+		return -1;
+
+	if (buf_alloc(&spare, rows, cols)) {
+		mem_free(snap_rows);
+		snap_rows = NULL;
+		return -1;
+	}
+
+	spare_cnt = rows;
+	snap_enabled = 1;
+
+	return 0;
+}
+
+const struct grid_cell *const *grid_snapshot(int start_row, int end_row)
+{
+	int row;
+
+	for (row = start_row; row < end_row; row++) {
+		snap_rows[row] = cur->rows[row];
+		*row_flags(snap_rows[row]) |= ROW_SHARED;
+	}
+
+	snap_start = start_row;
+	snap_end = end_row;
+
+	return (const struct grid_cell *const *)snap_rows;
+}
+
+void grid_snapshot_release(void)
+{
+	int row;
+
+	for (row = snap_start; row < snap_end; row++) {
+		struct grid_cell *r = snap_rows[row];
+
+		if (*row_flags(r) & ROW_ORPHAN)
+			spare.rows[spare_cnt++] = r;
+
+		*row_flags(r) = 0;
+	}
+
+	snap_start = snap_end = 0;
+}
+
+unsigned int grid_cells_utf8(const struct grid_cell *cells, int ncells,
+                             char *buf, uint16_t *col_off)
+{
+	unsigned int len = 0;
+	int col;
+
+	for (col = 0; col < ncells; col++) {
+		uint32_t ch = grid_cell_ch(&cells[col]);
+
+		if (cells[col].ch & GRID_CONT) {
+			if (col_off)
+				col_off[col] = col ? col_off[col-1] : 0;
+			continue;
+		}
+
+		if (col_off)
+			col_off[col] = len;
+
+		if (cells[col].ch & GRID_IMAGE)
+			ch = ' ';
+
+		len += gp_to_utf8(ch ? ch : ' ', buf + len);
+	}
+
+	while (len && buf[len-1] == ' ')
+		len--;
+
+	return len;
+}
+
+void grid_put_tiles(int row, int col, uint32_t first_tile, int ntiles)
+{
+	struct grid_cell *cells;
+	int i;
+
+	if (row < 0 || row >= rows || col < 0)
+		return;
+
+	ntiles = GP_MIN(ntiles, cols - col);
+	if (ntiles <= 0)
+		return;
+
+	cells = row_write(row);
+
+	for (i = 0; i < ntiles; i++) {
+		cells[col + i].ch = GRID_IMAGE | ((first_tile + i) & GRID_CH_MASK);
+		cells[col + i].fg = blank.fg;
+		cells[col + i].bg = blank.bg;
+	}
+
+	damage(row, row + 1, col, col + ntiles);
+}
+
+void grid_put_ascii(int row, int col, const char *str, int len)
+{
+	struct grid_cell *cells = &row_write(row)[col];
+	int i;
+
+	for (i = 0; i < len; i++) {
+		cells[i].ch = (uint8_t)str[i] | pen.ch;
+		cells[i].fg = pen.fg;
+		cells[i].bg = pen.bg;
+	}
+
+	damage(row, row + 1, col, col + len);
+}
+
+void grid_cells_from_screen(const VTermScreenCell *cells, int ncells,
+                            struct grid_cell *out)
+{
+	int col;
+
+	for (col = 0; col < ncells; col++) {
+		const VTermScreenCell *c = &cells[col];
+		uint32_t ch = c->chars[0];
+
+		if (ch == (uint32_t)-1)
+			ch = GRID_CONT;
+		else
+			ch &= GRID_CH_MASK;
+
+		if (c->width > 1)
+			ch |= GRID_WIDE;
+
+		if (c->attrs.bold)
+			ch |= GRID_BOLD;
+		if (c->attrs.underline)
+			ch |= GRID_UNDERLINE;
+		if (c->attrs.italic)
+			ch |= GRID_ITALIC;
+		if (c->attrs.blink)
+			ch |= GRID_BLINK;
+		if (c->attrs.reverse)
+			ch |= GRID_REVERSE;
+		if (c->attrs.conceal)
+			ch |= GRID_CONCEAL;
+		if (c->attrs.strike)
+			ch |= GRID_STRIKE;
+
+		out[col].ch = ch;
+		out[col].fg = color_idx(&c->fg);
+		out[col].bg = color_idx(&c->bg);
+	}
+}
+
+unsigned int grid_row_text(int row, char *buf, uint16_t *col_off)
+{
+	return grid_cells_utf8(grid_row[row], cols, buf, col_off);
+}
@@ -0,0 +1,131 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Compact cell grid maintained from libvterm state callbacks.
+
+   This replaces the libvterm screen layer, each cell is a 32-bit code point
+   with attributes packed into the upper bits and 8-bit palette indexes for
+   the foreground and background. The cells are allocated as a contiguous
+   row-major array, rows are accessed through an array of row pointers so that
+   full width scrolling only rotates the pointers.
+
+  */
+
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdint.h>
+#include <vterm.h>
+
+#define GRID_CH_MASK 0x001fffff
+
+enum grid_attr {
+	GRID_BOLD = 1u<<21,
+	GRID_UNDERLINE = 1u<<22,
+	GRID_ITALIC = 1u<<23,
+	GRID_BLINK = 1u<<24,
+	GRID_REVERSE = 1u<<25,
+	GRID_CONCEAL = 1u<<26,
+	GRID_STRIKE = 1u<<27,
+	/* Left half of a double width character */
+	GRID_WIDE = 1u<<28,
+	/* Right half of a double width character */
+	GRID_CONT = 1u<<29,
+	/* Image tile, the code point bits hold the tile id */
+	GRID_IMAGE = 1u<<30,
+};
+
+struct grid_cell {
+	uint32_t ch;
+	uint8_t fg;
+	uint8_t bg;
+};
+
+struct grid_callbacks {
+	int (*damage)(VTermRect rect, void *user);
+	int (*movecursor)(VTermPos pos, VTermPos oldpos, int visible, void *user);
+	int (*settermprop)(VTermProp prop, VTermValue *val, void *user);
+	int (*bell)(void *user);
+	int (*sb_pushline)(int cols, const struct grid_cell *cells, void *user);
+};
+
+/*
+ * Attaches the grid to the libvterm state, the screen layer must not be used.
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int grid_init(VTerm *vt, int altscreen, const struct grid_callbacks *callbacks,
+              uint8_t default_fg, uint8_t default_bg);
+
+void grid_exit(void);
+
+/*
+ * Row snapshots for rendering from another thread.
+ *
+ * The snapshot shares the rows with the grid, a row is copied only when it's
+ * about to be written to while the snapshot is held. There is at most one
+ * snapshot at a time and the grid must not be resized while it's held.
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int grid_snapshot_init(void);
+
+/*
+ * Takes a snapshot of the rows in the active buffer, only the rows in the
+ * range are valid in the returned array.
+ */
+const struct grid_cell *const *grid_snapshot(int start_row, int end_row);
+
+/*
+ * Releases the snapshot, rows that were replaced meanwhile are reused.
+ */
+void grid_snapshot_release(void);
+
+/* Rows of the active buffer */
+extern struct grid_cell **grid_row;
+
+static inline const struct grid_cell *grid_cell(int row, int col)
+{
+	return &grid_row[row][col];
+}
+
+static inline uint32_t grid_cell_ch(const struct grid_cell *cell)
+{
+	return cell->ch & GRID_CH_MASK;
+}
+
+/*
+ * Places a row of image tiles with consecutive ids, the tiles that do not fit
+ * the screen are dropped.
+ */
+void grid_put_tiles(int row, int col, uint32_t first_tile, int ntiles);
+
+/*
+ * Writes printable ASCII with the current pen, the text has to fit the row.
+ * Used by the fast path that bypasses libvterm for plain text.
+ */
+void grid_put_ascii(int row, int col, const char *str, int len);
+
+/*
+ * Converts grid cells into UTF-8, one character per column, for search.
+ */
+unsigned int grid_cells_utf8(const struct grid_cell *cells, int ncells,
+                             char *buf, uint16_t *col_off);
+
+/*
+ * Packs libvterm screen cells into grid cells, used to keep the scrollback in
+ * a single format regardless of where the screen cells are kept.
+ */
+void grid_cells_from_screen(const VTermScreenCell *cells, int ncells,
+                            struct grid_cell *out);
+
+/*
+ * Fetches screen row as UTF-8 text for search.
+ */
+unsigned int grid_row_text(int row, char *buf, uint16_t *col_off);
+
+#endif /* GRID_H */
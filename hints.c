@@ -0,0 +1,457 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <string.h>
+#include <gfxprim.h>
+
+#include "mem.h"
+#include "hints.h"
+
+#define HINTS_ROW_MAX 16
+
+struct row_match {
+	uint16_t start_col;
+	uint16_t end_col;
+	uint8_t kind;
+};
+
+struct row_hints {
+	/* Bumped by damage, the row is rescanned when it differs from scan_gen */
+	uint32_t gen;
+	uint32_t scan_gen;
+	uint8_t cnt;
+	uint8_t changed;
+	struct row_match m[HINTS_ROW_MAX];
+};
+
+static search_row_text row_text;
+static int rows;
+static int cols;
+static struct row_hints *row_hints;
+static char *text;
+static uint16_t *col_off;
+static uint8_t *map_row;
+static uint8_t *map_buf;
+
+/* Selected hint, row is -1 when nothing is selected */
+static int sel_row = -1;
+static unsigned int sel_idx;
+
+uint8_t *hints_map;
+int hints_map_cols;
+
+int hints_init(search_row_text fn)
+{
+	row_text = fn;
+
+	return 0;
+}
+
+static void hints_free(void)
+{
+	mem_free(row_hints);
+	mem_free(text);
+	mem_free(col_off);
+	mem_free(map_row);
+	mem_free(map_buf);
+
+	row_hints = NULL;
+	text = NULL;
+	col_off = NULL;
+	map_row = NULL;
+	map_buf = NULL;
+	hints_map = NULL;
+}
+
+int hints_resize(int new_rows, int new_cols)
+{
+	int row;
+
+	hints_free();
+
+	rows = new_rows;
+	cols = new_cols;
+	sel_row = -1;
+
+	row_hints = mem_alloc(MEM_HINTS, rows * sizeof(*row_hints));
+	text = mem_alloc(MEM_HINTS, SEARCH_BYTES_PER_COL * cols + 1);
+	col_off = mem_alloc(MEM_HINTS, cols * sizeof(*col_off));
+	map_row = mem_alloc(MEM_HINTS, cols);
+	map_buf = mem_alloc(MEM_HINTS, rows * cols);
+
+	if (!row_hints || !text || !col_off || !map_row || !map_buf) {
+		hints_free();
+		return -1;
+	}
+
+	for (row = 0; row < rows; row++)
+		row_hints[row].gen = 1;
+
+	hints_map = map_buf;
+	hints_map_cols = cols;
+
+	return 0;
+}
+
+void hints_damage(int start_row, int end_row)
+{
+	int row;
+
+	if (!row_hints)
+		return;
+
+	start_row = GP_MAX(0, start_row);
+	end_row = GP_MIN(rows, end_row);
+
+	for (row = start_row; row < end_row; row++)
+		row_hints[row].gen++;
+}
+
+static int url_char(unsigned char c)
+{
+	return c > 0x20 && c < 0x7f && !strchr("<>\"'`{}|\\^", c);
+}
+
+static int scheme_char(unsigned char c)
+{
+	return isalnum(c) || c == '+' || c == '.' || c == '-';
+}
+
+static int path_char(unsigned char c)
+{
+	return isalnum(c) || strchr("/._-+~", c);
+}
+
+/*
+ * Returns column for a byte offset into the row text.
+ */
+static uint16_t byte_col(size_t off)
+{
+	int lo = 0, hi = cols - 1;
+
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+
+		if (col_off[mid] <= off)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+static int overlaps(const struct row_hints *rh, size_t start_col, size_t end_col)
+{
+	unsigned int i;
+
+	for (i = 0; i < rh->cnt; i++) {
+		if (start_col < rh->m[i].end_col && end_col > rh->m[i].start_col)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void add_match(struct row_hints *rh, size_t start, size_t end, enum hint_kind kind)
+{
+	uint16_t start_col = byte_col(start);
+	uint16_t end_col = byte_col(end - 1) + 1;
+	unsigned int i;
+
+	if (rh->cnt >= HINTS_ROW_MAX || overlaps(rh, start_col, end_col))
+		return;
+
+	/* Kept sorted by the column */
+	for (i = rh->cnt; i > 0 && rh->m[i-1].start_col > start_col; i--)
+		rh->m[i] = rh->m[i-1];
+
+	rh->m[i].start_col = start_col;
+	rh->m[i].end_col = end_col;
+	rh->m[i].kind = kind;
+	rh->cnt++;
+}
+
+/*
+ * Finds scheme://rest, the trailing punctuation is not part of the URL.
+ */
+static void scan_urls(struct row_hints *rh, size_t len)
+{
+	const char *p = text;
+	const char *end = text + len;
+
+	while ((p = memmem(p, end - p, "://", 3))) {
+		size_t sep = p - text;
+		size_t start = sep, stop = sep + 3;
+		int parens = 0;
+
+		while (start > 0 && scheme_char(text[start-1]))
+			start--;
+
+		while (start < sep && !isalpha((unsigned char)text[start]))
+			start++;
+
+		while (stop < len && url_char(text[stop])) {
+			if (text[stop] == '(')
+				parens++;
+			if (text[stop] == ')')
+				parens--;
+			stop++;
+		}
+
+		while (stop > sep + 3 &&
+		       (strchr(".,;:!?", text[stop-1]) || (text[stop-1] == ')' && parens < 0))) {
+			if (text[stop-1] == ')')
+				parens++;
+			stop--;
+		}
+
+		if (start < sep && stop > sep + 3)
+			add_match(rh, start, stop, HINT_URL);
+
+		p = text + GP_MAX(stop, sep + 3);
+	}
+}
+
+/*
+ * Finds path:line and path:line:col where path contains a letter and a dot
+ * or a slash so that times and addresses do not match.
+ */
+static void scan_files(struct row_hints *rh, size_t len)
+{
+	const char *p = text;
+	const char *end = text + len;
+
+	while ((p = memchr(p, ':', end - p))) {
+		size_t colon = p - text;
+		size_t start = colon, stop = colon + 1, i;
+		int alpha = 0, sep = 0;
+
+		p++;
+
+		if (stop >= len || !isdigit((unsigned char)text[stop]))
+			continue;
+
+		while (start > 0 && path_char(text[start-1]))
+			start--;
+
+		for (i = start; i < colon; i++) {
+			alpha |= isalpha((unsigned char)text[i]);
+			sep |= text[i] == '.' || text[i] == '/';
+		}
+
+		if (!alpha || !sep)
+			continue;
+
+		while (stop < len && isdigit((unsigned char)text[stop]))
+			stop++;
+
+		if (stop + 1 < len && text[stop] == ':' && isdigit((unsigned char)text[stop+1])) {
+			stop++;
+			while (stop < len && isdigit((unsigned char)text[stop]))
+				stop++;
+		}
+
+		add_match(rh, start, stop, HINT_FILE);
+		p = text + stop;
+	}
+}
+
+static void update_map_row(int row)
+{
+	struct row_hints *rh = &row_hints[row];
+	uint8_t *map = hints_map + row * cols;
+	unsigned int i;
+
+	memset(map_row, 0, cols);
+
+	for (i = 0; i < rh->cnt; i++) {
+		uint8_t val = HINT_UNDERLINE;
+
+		if (row == sel_row && i == sel_idx)
+			val |= HINT_SELECTED;
+
+		memset(map_row + rh->m[i].start_col, val,
+		       rh->m[i].end_col - rh->m[i].start_col);
+	}
+
+	if (memcmp(map, map_row, cols)) {
+		memcpy(map, map_row, cols);
+		rh->changed = 1;
+	}
+}
+
+static void scan_row(int row)
+{
+	struct row_hints *rh = &row_hints[row];
+	uint16_t sel_col = 0;
+	unsigned int i;
+	size_t len;
+
+	if (row == sel_row)
+		sel_col = rh->m[sel_idx].start_col;
+
+	rh->scan_gen = rh->gen;
+	rh->cnt = 0;
+
+	len = row_text(row, text, col_off);
+
+	/* Both kinds of hints contain a colon */
+	if (memchr(text, ':', len)) {
+		scan_urls(rh, len);
+		scan_files(rh, len);
+	}
+
+	if (row == sel_row) {
+		for (i = 0; i < rh->cnt && rh->m[i].start_col != sel_col; i++);
+
+		if (i < rh->cnt)
+			sel_idx = i;
+		else
+			sel_row = -1;
+	}
+
+	update_map_row(row);
+}
+
+void hints_update(void)
+{
+	int row;
+
+	if (!row_hints)
+		return;
+
+	for (row = 0; row < rows; row++) {
+		if (row_hints[row].gen != row_hints[row].scan_gen)
+			scan_row(row);
+	}
+}
+
+int hints_row_changed(int row)
+{
+	int ret;
+
+	if (!row_hints)
+		return 0;
+
+	ret = row_hints[row].changed;
+	row_hints[row].changed = 0;
+
+	return ret;
+}
+
+static void fill_hint(int row, unsigned int idx, struct hint *hint)
+{
+	hint->row = row;
+	hint->start_col = row_hints[row].m[idx].start_col;
+	hint->end_col = row_hints[row].m[idx].end_col;
+	hint->kind = row_hints[row].m[idx].kind;
+}
+
+int hints_at(int row, int col, struct hint *hint)
+{
+	unsigned int i;
+
+	if (!row_hints || row < 0 || row >= rows)
+		return -1;
+
+	hints_update();
+
+	for (i = 0; i < row_hints[row].cnt; i++) {
+		if (col >= row_hints[row].m[i].start_col &&
+		    col < row_hints[row].m[i].end_col) {
+			fill_hint(row, i, hint);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int hints_select(int dir, struct hint *hint)
+{
+	int old_row = sel_row;
+	int row = sel_row;
+	int idx = sel_idx;
+
+	if (!row_hints || !rows)
+		return -1;
+
+	hints_update();
+
+	/* Start past the last hint of the last row */
+	if (row < 0) {
+		row = rows - 1;
+		idx = row_hints[row].cnt;
+		dir = -1;
+	}
+
+	idx += dir;
+
+	/* Walk over the rows until there is a match in the direction */
+	while (idx < 0 || idx >= row_hints[row].cnt) {
+		row += dir;
+
+		if (row < 0 || row >= rows)
+			break;
+
+		idx = dir < 0 ? row_hints[row].cnt - 1 : 0;
+	}
+
+	if (row < 0 || row >= rows) {
+		if (old_row < 0)
+			return -1;
+
+		/* Stay on the first or last hint */
+		fill_hint(old_row, sel_idx, hint);
+		return 0;
+	}
+
+	sel_row = row;
+	sel_idx = idx;
+
+	if (old_row >= 0)
+		update_map_row(old_row);
+
+	update_map_row(sel_row);
+	fill_hint(sel_row, sel_idx, hint);
+
+	return 0;
+}
+
+void hints_select_clear(void)
+{
+	int row = sel_row;
+
+	if (row < 0)
+		return;
+
+	sel_row = -1;
+	update_map_row(row);
+}
+
+int hints_text(const struct hint *hint, char *buf, size_t size)
+{
+	size_t len, start, end;
+
+	if (!row_hints || hint->row < 0 || hint->row >= rows)
+		return -1;
+
+	len = row_text(hint->row, text, col_off);
+
+	start = col_off[hint->start_col];
+	end = hint->end_col < cols ? col_off[hint->end_col] : len;
+	end = GP_MIN(end, len);
+
+	if (start >= end || end - start >= size)
+		return -1;
+
+	memcpy(buf, text + start, end - start);
+	buf[end - start] = 0;
+
+	return 0;
+}
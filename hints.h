@@ -0,0 +1,99 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   URL and file:line hints on the screen.
+
+   Each screen row has a generation counter that is bumped by the damage, the
+   rows are rescanned only when the generation differs from the one the
+   matches were found for. Many damages between two frames end up as a single
+   scan of the row.
+
+   The matches are kept per row and mirrored into a cell map the renderer
+   underlines from. Matches that wrap to the next row are not detected.
+
+  */
+
+#ifndef HINTS_H
+#define HINTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "search.h"
+
+#define HINT_UNDERLINE 0x01
+#define HINT_SELECTED 0x02
+
+enum hint_kind {
+	HINT_URL,
+	HINT_FILE,
+};
+
+struct hint {
+	int row;
+	uint16_t start_col;
+	uint16_t end_col;
+	enum hint_kind kind;
+};
+
+int hints_init(search_row_text row_text);
+
+/*
+ * Reallocates the per row caches, all rows are rescanned.
+ */
+int hints_resize(int rows, int cols);
+
+/*
+ * Bumps the generation of the damaged rows.
+ */
+void hints_damage(int start_row, int end_row);
+
+/*
+ * Rescans rows that changed since they were scanned.
+ */
+void hints_update(void);
+
+/*
+ * Returns non-zero if row hints changed since the last call.
+ */
+int hints_row_changed(int row);
+
+/*
+ * Looks up a hint at a cell, returns 0 on success, -1 if there is none.
+ */
+int hints_at(int row, int col, struct hint *hint);
+
+/*
+ * Moves the selection, dir < 0 towards the top of the screen. The first
+ * call selects the bottom most hint.
+ *
+ * Returns 0 on success, -1 if there are no hints.
+ */
+int hints_select(int dir, struct hint *hint);
+
+void hints_select_clear(void);
+
+/*
+ * Copies the hint text into a zero terminated buffer.
+ *
+ * Returns 0 on success, -1 if the hint does not fit.
+ */
+int hints_text(const struct hint *hint, char *buf, size_t size);
+
+/* Cell map, NULL when hints are disabled */
+extern uint8_t *hints_map;
+extern int hints_map_cols;
+
+static inline uint8_t hints_cell(int row, int col)
+{
+	if (!hints_map)
+		return 0;
+
+	return hints_map[row * hints_map_cols + col];
+}
+
+#endif /* HINTS_H */
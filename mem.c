@@ -0,0 +1,289 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+
+#define MEM_ALIGN 16
+#define MEM_ROUND(size) (((size) + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1))
+
+#define MAGIC_USED 0x7e4a11c0
+#define MAGIC_FREE 0x7e4af7ee
+
+struct mem_hdr {
+	/* whole block size in arena, requested size on heap */
+	size_t size;
+	uint32_t tag;
+	uint32_t magic;
+};
+
+#define HDR_SIZE MEM_ROUND(sizeof(struct mem_hdr))
+
+struct free_blk {
+	struct mem_hdr hdr;
+	struct free_blk *next;
+};
+
+#define MIN_BLOCK MEM_ROUND(sizeof(struct free_blk))
+
+static const char *tag_names[MEM_TAGS] = {
+	[MEM_VTERM] = "vterm",
+	[MEM_RENDER] = "render",
+	[MEM_SCROLLBACK] = "scrollback",
+	[MEM_SEARCH] = "search",
+	[MEM_GRID] = "grid",
+	[MEM_IMAGE] = "images",
+	[MEM_HINTS] = "hints",
+};
+
+static struct mem_stat {
+	size_t cur;
+	size_t peak;
+	size_t statics;
+	unsigned long allocs;
+	unsigned long failed;
+} stats[MEM_TAGS];
+
+static struct arena {
+	uint8_t *base;
+	size_t size;
+	size_t used;
+	size_t peak;
+	struct free_blk *free_list;
+} arena;
+
+int mem_arena_init(size_t size)
+{
+	size = MEM_ROUND(size);
+
+	/*
+	 * Prefault the arena, the footprint is known upfront and we don't get
+	 * page faults in the middle of rendering.
+	 */
+	arena.base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (arena.base == MAP_FAILED) {
+		arena.base = NULL;
+		return -1;
+	}
+
+	arena.size = size;
+	arena.free_list = (struct free_blk *)arena.base;
+	arena.free_list->hdr.size = size;
+	arena.free_list->hdr.magic = MAGIC_FREE;
+	arena.free_list->next = NULL;
+
+	return 0;
+}
+
+int mem_arena_enabled(void)
+{
+	return !!arena.base;
+}
+
+static struct free_blk *arena_find(size_t need, struct free_blk ***prev_next)
+{
+	struct free_blk **pnext = &arena.free_list;
+	struct free_blk *blk;
+
+	for (blk = arena.free_list; blk; blk = blk->next) {
+		if (blk->hdr.size >= need) {
+			if (prev_next)
+				*prev_next = pnext;
+			return blk;
+		}
+		pnext = &blk->next;
+	}
+
+	return NULL;
+}
+
+static size_t block_size(size_t size)
+{
+	size_t need = HDR_SIZE + MEM_ROUND(size);
+
+	/* Freed block has to be able to hold the free list pointer */
+	return need < MIN_BLOCK ? MIN_BLOCK : need;
+}
+
+int mem_fits(size_t size)
+{
+	if (!arena.base)
+		return 1;
+
+	return !!arena_find(block_size(size), NULL);
+}
+
+static struct mem_hdr *arena_alloc(size_t size)
+{
+	size_t need = block_size(size);
+	struct free_blk **pnext, *blk;
+
+	blk = arena_find(need, &pnext);
+	if (!blk)
+		return NULL;
+
+	if (blk->hdr.size - need >= MIN_BLOCK) {
+		struct free_blk *rest = (struct free_blk *)((uint8_t *)blk + need);
+
+		rest->hdr.size = blk->hdr.size - need;
+		rest->hdr.magic = MAGIC_FREE;
+		rest->next = blk->next;
+		*pnext = rest;
+		blk->hdr.size = need;
+	} else {
+		*pnext = blk->next;
+	}
+
+	arena.used += blk->hdr.size;
+	arena.peak = arena.used > arena.peak ? arena.used : arena.peak;
+
+	return &blk->hdr;
+}
+
+static void arena_free(struct mem_hdr *hdr)
+{
+	struct free_blk *blk = (struct free_blk *)hdr;
+	struct free_blk **pnext = &arena.free_list;
+	struct free_blk *prev = NULL;
+
+	arena.used -= hdr->size;
+	hdr->magic = MAGIC_FREE;
+
+	/* Keep the list sorted by address so that we can merge neighbours */
+	while (*pnext && *pnext < blk) {
+		prev = *pnext;
+		pnext = &(*pnext)->next;
+	}
+
+	blk->next = *pnext;
+	*pnext = blk;
+
+	if (blk->next && (uint8_t *)blk + blk->hdr.size == (uint8_t *)blk->next) {
+		blk->hdr.size += blk->next->hdr.size;
+		blk->next = blk->next->next;
+	}
+
+	if (prev && (uint8_t *)prev + prev->hdr.size == (uint8_t *)blk) {
+		prev->hdr.size += blk->hdr.size;
+		prev->next = blk->next;
+	}
+}
+
+static size_t payload_size(struct mem_hdr *hdr)
+{
+	return arena.base ? hdr->size - HDR_SIZE : hdr->size;
+}
+
+void *mem_alloc(enum mem_tag tag, size_t size)
+{
+	struct mem_hdr *hdr;
+
+	if (arena.base) {
+		hdr = arena_alloc(size);
+	} else {
+		hdr = malloc(HDR_SIZE + size);
+		if (hdr)
+			hdr->size = size;
+	}
+
+	if (!hdr) {
+		stats[tag].failed++;
+		fprintf(stderr, "Failed to allocate %zu bytes for %s\n",
+		        size, tag_names[tag]);
+		return NULL;
+	}
+
+	hdr->tag = tag;
+	hdr->magic = MAGIC_USED;
+
+	stats[tag].allocs++;
+	stats[tag].cur += payload_size(hdr);
+	if (stats[tag].cur > stats[tag].peak)
+		stats[tag].peak = stats[tag].cur;
+
+	void *ptr = (uint8_t *)hdr + HDR_SIZE;
+
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+void mem_free(void *ptr)
+{
+	struct mem_hdr *hdr;
+
+	if (!ptr)
+		return;
+
+	hdr = (struct mem_hdr *)((uint8_t *)ptr - HDR_SIZE);
+
+	if (hdr->magic != MAGIC_USED) {
+		fprintf(stderr, "mem_free() on invalid pointer %p\n", ptr);
+		abort();
+	}
+
+	stats[hdr->tag].cur -= payload_size(hdr);
+
+	if (arena.base)
+		arena_free(hdr);
+	else
+		free(hdr);
+}
+
+void mem_account_static(enum mem_tag tag, size_t size)
+{
+	stats[tag].statics += size;
+}
+
+static void print_proc_status(FILE *f)
+{
+	FILE *status = fopen("/proc/self/status", "r");
+	char line[128];
+
+	if (!status)
+		return;
+
+	while (fgets(line, sizeof(line), status)) {
+		if (!strncmp(line, "VmRSS:", 6) || !strncmp(line, "VmHWM:", 6) ||
+		    !strncmp(line, "VmData:", 7))
+			fprintf(f, "  %s", line);
+	}
+
+	fclose(status);
+}
+
+void mem_report(FILE *f)
+{
+	size_t cur = 0, statics = 0;
+	int i;
+
+	fprintf(f, "Memory report:\n");
+	fprintf(f, "  %-12s %10s %10s %10s %8s %6s\n",
+	        "", "current", "peak", "static", "allocs", "failed");
+
+	for (i = 0; i < MEM_TAGS; i++) {
+		fprintf(f, "  %-12s %10zu %10zu %10zu %8lu %6lu\n", tag_names[i],
+		        stats[i].cur, stats[i].peak, stats[i].statics,
+		        stats[i].allocs, stats[i].failed);
+		cur += stats[i].cur;
+		statics += stats[i].statics;
+	}
+
+	fprintf(f, "  %-12s %10zu %10s %10zu\n", "total", cur, "", statics);
+
+	if (arena.base) {
+		fprintf(f, "  arena: size %zu used %zu peak %zu\n",
+		        arena.size, arena.used, arena.peak);
+	} else {
+		fprintf(f, "  arena: disabled\n");
+	}
+
+	print_proc_status(f);
+}
@@ -0,0 +1,68 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Accounted memory allocations.
+
+   By default allocations are passed down to malloc() and only accounted, in
+   the low memory profile all per-terminal state is allocated from a fixed
+   size arena that is set up at the startup. Once the arena is exhausted
+   allocations fail instead of growing the process.
+
+  */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+enum mem_tag {
+	MEM_VTERM,
+	MEM_RENDER,
+	MEM_SCROLLBACK,
+	MEM_SEARCH,
+	MEM_GRID,
+	MEM_IMAGE,
+	MEM_HINTS,
+	MEM_TAGS,
+};
+
+/*
+ * Switches to the fixed size arena, has to be called before any allocation.
+ *
+ * Returns 0 on success, -1 if the arena couldn't be allocated.
+ */
+int mem_arena_init(size_t size);
+
+/*
+ * Returns non-zero if allocations are served from the arena.
+ */
+int mem_arena_enabled(void);
+
+/*
+ * Returns true if size bytes can be allocated, always true without arena.
+ */
+int mem_fits(size_t size);
+
+/*
+ * Allocates zeroed memory, returns NULL on failure.
+ */
+void *mem_alloc(enum mem_tag tag, size_t size);
+
+void mem_free(void *ptr);
+
+/*
+ * Accounts memory that is not allocated dynamically, e.g. static caches.
+ */
+void mem_account_static(enum mem_tag tag, size_t size);
+
+/*
+ * Prints where memory goes.
+ */
+void mem_report(FILE *f);
+
+#endif /* MEM_H */
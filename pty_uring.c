@@ -0,0 +1,420 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "config.h"
+#include "stats.h"
+#include "pty_uring.h"
+
+#ifdef HAVE_LIBURING
+
+#include <sys/uio.h>
+#include <liburing.h>
+
+/* The completion queue, twice the entries, holds a read for each buffer */
+#define RING_ENTRIES 8
+#define READ_BUFS 8
+#define READ_BUF_SIZE 4096
+#define READ_BGID 0
+#define WRITE_BUF_SIZE 4096
+
+enum req {
+	REQ_READ = 1,
+	REQ_WRITE,
+};
+
+static struct io_uring ring;
+static int pty_fd = -1;
+static int sqes_pending;
+static pty_uring_read_cb read_cb;
+
+/*
+ * With multishot read the kernel picks the buffers from the ring and the
+ * buffers are returned once parsed. Otherwise a single read is posted into
+ * the next buffer while the previous one is being parsed.
+ */
+static char read_bufs[READ_BUFS][READ_BUF_SIZE];
+static struct io_uring_buf_ring *read_ring;
+static int read_idx;
+static int read_fixed;
+
+/*
+ * Completed reads that arrived while waiting for a write, these are the reads
+ * that hold a buffer and at most one final completion for the armed and for
+ * the reposted multishot read.
+ */
+#define READ_STASH (READ_BUFS + 2)
+
+static struct {
+	int res;
+	unsigned int flags;
+} read_stash[READ_STASH];
+static unsigned int stash_head;
+static unsigned int stash_tail;
+
+/* One buffer is being written while the other is filled */
+static char write_bufs[2][WRITE_BUF_SIZE];
+static size_t write_len[2];
+static size_t write_off;
+static int write_fill;
+static int write_busy;
+
+static struct io_uring_sqe *get_sqe(void)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+	if (!sqe) {
+		stats.pty_syscalls++;
+		io_uring_submit(&ring);
+		sqes_pending = 0;
+		sqe = io_uring_get_sqe(&ring);
+	}
+
+	if (sqe)
+		sqes_pending++;
+
+	return sqe;
+}
+
+static void submit(void)
+{
+	if (!sqes_pending)
+		return;
+
+	stats.pty_syscalls++;
+	io_uring_submit(&ring);
+	sqes_pending = 0;
+}
+
+static void post_read(void)
+{
+	struct io_uring_sqe *sqe = get_sqe();
+
+	if (!sqe)
+		return;
+
+	if (read_ring) {
+		io_uring_prep_read_multishot(sqe, pty_fd, 0, 0, READ_BGID);
+	} else if (read_fixed) {
+		io_uring_prep_read_fixed(sqe, pty_fd, read_bufs[read_idx],
+		                         READ_BUF_SIZE, -1, read_idx);
+	} else {
+		io_uring_prep_read(sqe, pty_fd, read_bufs[read_idx],
+		                   READ_BUF_SIZE, -1);
+	}
+
+	io_uring_sqe_set_data(sqe, (void*)REQ_READ);
+}
+
+static void return_buf(int idx)
+{
+	io_uring_buf_ring_add(read_ring, read_bufs[idx], READ_BUF_SIZE, idx,
+	                      io_uring_buf_ring_mask(READ_BUFS), 0);
+	io_uring_buf_ring_advance(read_ring, 1);
+}
+
+static void post_write(void)
+{
+	int idx = !write_fill;
+	struct io_uring_sqe *sqe = get_sqe();
+
+	if (!sqe)
+		return;
+
+	io_uring_prep_write(sqe, pty_fd, write_bufs[idx] + write_off,
+	                    write_len[idx] - write_off, -1);
+	io_uring_sqe_set_data(sqe, (void*)REQ_WRITE);
+}
+
+/*
+ * Swaps the write buffers and posts the filled one.
+ */
+static void queue_writes(void)
+{
+	if (write_busy || !write_len[write_fill])
+		return;
+
+	write_fill = !write_fill;
+	write_off = 0;
+	write_busy = 1;
+
+	post_write();
+}
+
+/*
+ * Reposted reads are submitted with the writes at the end of
+ * pty_uring_complete(), a multishot read stays armed until the kernel runs
+ * out of the buffers.
+ */
+static void read_done(int res, unsigned int flags)
+{
+	int idx = read_idx;
+	int more = 0;
+
+	if (read_ring) {
+		idx = flags >> IORING_CQE_BUFFER_SHIFT;
+		more = flags & IORING_CQE_F_MORE;
+	}
+
+	if (res == -EAGAIN || res == -EINTR || res == -ENOBUFS) {
+		if (!more)
+			post_read();
+		return;
+	}
+
+	if (res > 0) {
+		stats.pty_bytes += res;
+		read_idx = (read_idx + 1) % READ_BUFS;
+
+		if (!more)
+			post_read();
+	}
+
+	read_cb(pty_fd, read_bufs[idx], res);
+
+	if (read_ring && res > 0)
+		return_buf(idx);
+}
+
+static void write_done(int res)
+{
+	int idx = !write_fill;
+
+	if (res == -EAGAIN || res == -EINTR) {
+		post_write();
+		return;
+	}
+
+	if (res < 0) {
+		fprintf(stderr, "PTY write failed: %s\n", strerror(-res));
+		write_off = write_len[idx];
+	} else {
+		write_off += res;
+	}
+
+	if (write_off < write_len[idx]) {
+		post_write();
+		return;
+	}
+
+	write_len[idx] = 0;
+	write_busy = 0;
+
+	queue_writes();
+}
+
+static void cqe_done(struct io_uring_cqe *cqe, int stash_reads)
+{
+	enum req req = (enum req)(uintptr_t)io_uring_cqe_get_data(cqe);
+	unsigned int flags = cqe->flags;
+	int res = cqe->res;
+
+	io_uring_cqe_seen(&ring, cqe);
+
+	switch (req) {
+	case REQ_READ:
+		if (stash_reads) {
+			read_stash[stash_tail % READ_STASH].res = res;
+			read_stash[stash_tail % READ_STASH].flags = flags;
+			stash_tail++;
+			return;
+		}
+
+		read_done(res, flags);
+	break;
+	case REQ_WRITE:
+		write_done(res);
+	break;
+	}
+}
+
+/*
+ * Blocks until the write buffer in flight is written.
+ */
+static void wait_write(void)
+{
+	struct io_uring_cqe *cqe;
+
+	while (write_busy) {
+		submit();
+
+		stats.pty_syscalls++;
+		if (io_uring_wait_cqe(&ring, &cqe))
+			return;
+
+		cqe_done(cqe, 1);
+	}
+}
+
+void pty_uring_complete(void)
+{
+	struct io_uring_cqe *cqe;
+
+	/* Parsing may wait for a write and stash more reads */
+	while (stash_head != stash_tail) {
+		unsigned int i = stash_head++ % READ_STASH;
+
+		read_done(read_stash[i].res, read_stash[i].flags);
+	}
+
+	while (!io_uring_peek_cqe(&ring, &cqe))
+		cqe_done(cqe, 0);
+
+	/* Writes queued while parsing, i.e. terminal replies */
+	queue_writes();
+	submit();
+}
+
+void pty_uring_write(const char *buf, size_t len)
+{
+	while (len) {
+		size_t space = WRITE_BUF_SIZE - write_len[write_fill];
+		size_t size = len < space ? len : space;
+
+		if (!space) {
+			queue_writes();
+			wait_write();
+			continue;
+		}
+
+		memcpy(write_bufs[write_fill] + write_len[write_fill], buf, size);
+		write_len[write_fill] += size;
+		buf += size;
+		len -= size;
+	}
+}
+
+void pty_uring_flush(void)
+{
+	queue_writes();
+	submit();
+}
+
+/*
+ * Multishot read needs Linux 6.7, older kernels post a read per completion.
+ */
+static void setup_read_ring(void)
+{
+	struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+	int i, ret, supported;
+
+	supported = probe && io_uring_opcode_supported(probe, IORING_OP_READ_MULTISHOT);
+	io_uring_free_probe(probe);
+
+	if (!supported)
+		return;
+
+	read_ring = io_uring_setup_buf_ring(&ring, READ_BUFS, READ_BGID, 0, &ret);
+	if (!read_ring) {
+		fprintf(stderr, "io_uring buffer ring: %s\n", strerror(-ret));
+		return;
+	}
+
+	for (i = 0; i < READ_BUFS; i++)
+		return_buf(i);
+}
+
+static void register_read_bufs(void)
+{
+	struct iovec iov[READ_BUFS];
+	int i, ret;
+
+	for (i = 0; i < READ_BUFS; i++) {
+		iov[i].iov_base = read_bufs[i];
+		iov[i].iov_len = READ_BUF_SIZE;
+	}
+
+	/* Registering buffers may fail e.g. on low RLIMIT_MEMLOCK */
+	ret = io_uring_register_buffers(&ring, iov, READ_BUFS);
+	if (ret)
+		fprintf(stderr, "io_uring buffers not registered: %s\n", strerror(-ret));
+
+	read_fixed = !ret;
+}
+
+int pty_uring_init(int fd, pty_uring_read_cb cb)
+{
+	int ret, flags;
+
+	ret = io_uring_queue_init(RING_ENTRIES, &ring, 0);
+	if (ret) {
+		fprintf(stderr, "io_uring not available: %s\n", strerror(-ret));
+		return -1;
+	}
+
+	setup_read_ring();
+
+	if (!read_ring)
+		register_read_bufs();
+
+	/*
+	 * Single reads on non-blocking fd would complete with EAGAIN instead of
+	 * waiting. Multishot read waits in a poll armed on EAGAIN, on a blocking
+	 * fd it does not complete on hangup.
+	 */
+	flags = fcntl(fd, F_GETFL, 0);
+	if (read_ring)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	else
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+
+	pty_fd = fd;
+	read_cb = cb;
+
+	post_read();
+	submit();
+
+	return ring.ring_fd;
+}
+
+void pty_uring_exit(void)
+{
+	if (pty_fd < 0)
+		return;
+
+	if (read_ring)
+		io_uring_free_buf_ring(&ring, read_ring, READ_BUFS, READ_BGID);
+
+	io_uring_queue_exit(&ring);
+	read_ring = NULL;
+	pty_fd = -1;
+}
+
+#else
+
+int pty_uring_init(int fd, pty_uring_read_cb read_cb)
+{
+	(void)fd;
+	(void)read_cb;
+
+	fprintf(stderr, "Compiled without io_uring support\n");
+
+	return -1;
+}
+
+void pty_uring_complete(void)
+{
+}
+
+void pty_uring_write(const char *buf, size_t len)
+{
+	(void)buf;
+	(void)len;
+}
+
+void pty_uring_flush(void)
+{
+}
+
+void pty_uring_exit(void)
+{
+}
+
+#endif /* HAVE_LIBURING */
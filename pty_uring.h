@@ -0,0 +1,55 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   PTY I/O over io_uring.
+
+   A multishot read is kept armed on the master fd, the kernel fills the
+   buffers from a buffer ring and the buffers are returned to the ring once
+   parsed, so that a wakeup does not cost a syscall unless the kernel ran out
+   of the buffers. Kernels without multishot read get a read into registered
+   buffers reposted for each completion. Reposted reads are submitted
+   together with the writes queued while parsing and writes are queued and
+   submitted in a batch on flush.
+
+   The ring fd is polled by the main loop, it is readable while there are
+   completions.
+
+  */
+
+#ifndef PTY_URING_H
+#define PTY_URING_H
+
+/*
+ * Called with the data read from the PTY, len <= 0 on error or end of file.
+ */
+typedef void (*pty_uring_read_cb)(int fd, const char *buf, int len);
+
+/*
+ * Sets up the ring and posts the first read.
+ *
+ * Returns the ring fd to poll on or -1 if io_uring is not available.
+ */
+int pty_uring_init(int fd, pty_uring_read_cb read_cb);
+
+/*
+ * Processes completions, to be called when the ring fd is readable.
+ */
+void pty_uring_complete(void);
+
+/*
+ * Queues data to be written to the PTY.
+ */
+void pty_uring_write(const char *buf, size_t len);
+
+/*
+ * Submits queued writes.
+ */
+void pty_uring_flush(void);
+
+void pty_uring_exit(void);
+
+#endif /* PTY_URING_H */
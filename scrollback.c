@@ -0,0 +1,398 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mem.h"
+#include "scrollback.h"
+
+/* Lines per index entry */
+#define BLOCK_LINES 64
+/* Number of most recent segments that are not paged out */
+#define HOT_SEGMENTS 2
+
+/* Line header is two varints, cell is at most a span header and a character */
+#define VARINT_MAX 5
+#define SPAN_MAX (VARINT_MAX + 2 + 2)
+#define CH_MAX 3
+
+struct segment {
+	uint8_t *map;
+	/* bytes used by lines from the start of the segment */
+	uint32_t used;
+	/* index entries stored backwards from the end of the segment */
+	uint32_t blocks;
+	/* absolute number of the first line */
+	uint64_t first_line;
+	uint32_t lines;
+};
+
+/* Ring of segments, the first one is the oldest */
+static struct segment *segs;
+static unsigned int segs_max;
+static unsigned int segs_first;
+static unsigned int segs_cnt;
+
+static uint64_t total_lines;
+static struct grid_cell blank;
+static const char *tmpdir;
+static int disabled;
+
+static struct segment *seg_at(unsigned int i)
+{
+	return &segs[(segs_first + i) % segs_max];
+}
+
+static uint32_t *seg_idx(const struct segment *seg, uint32_t block)
+{
+	return (uint32_t *)(seg->map + SCROLLBACK_SEGMENT_SIZE) - block - 1;
+}
+
+static int seg_fits(const struct segment *seg, size_t len)
+{
+	size_t idx_size = 4 * seg->blocks;
+
+	if (!(seg->lines % BLOCK_LINES))
+		idx_size += 4;
+
+	return seg->used + len + idx_size <= SCROLLBACK_SEGMENT_SIZE;
+}
+
+/*
+ * Creates the segment file in a fresh private directory, the file and the
+ * directory are removed right away and the file lives as long as it's opened
+ * or mapped.
+ */
+static int seg_file(void)
+{
+	char dir[PATH_MAX], path[PATH_MAX + 16];
+	int fd, err;
+
+	if (snprintf(dir, sizeof(dir), "%s/termini-XXXXXX", tmpdir) >= (int)sizeof(dir)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if (!mkdtemp(dir))
+		return -1;
+
+	snprintf(path, sizeof(path), "%s/scrollback", dir);
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	err = errno;
+
+	if (fd >= 0)
+		unlink(path);
+
+	rmdir(dir);
+
+	errno = err;
+	return fd;
+}
+
+static uint8_t *seg_map(void)
+{
+	uint8_t *map;
+	int fd, err;
+
+	fd = seg_file();
+	if (fd < 0)
+		return NULL;
+
+	/* Allocate the blocks upfront, writes to the mapping would SIGBUS on ENOSPC */
+	err = posix_fallocate(fd, 0, SCROLLBACK_SEGMENT_SIZE);
+	if (err) {
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+
+	map = mmap(NULL, SCROLLBACK_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+	           MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	return map;
+}
+
+static void seg_pageout(struct segment *seg)
+{
+#ifdef MADV_PAGEOUT
+	if (!madvise(seg->map, SCROLLBACK_SEGMENT_SIZE, MADV_PAGEOUT))
+		return;
+#endif
+	/* Dirty pages of shared file mapping are kept in the page cache */
+	madvise(seg->map, SCROLLBACK_SEGMENT_SIZE, MADV_DONTNEED);
+}
+
+static struct segment *seg_new(void)
+{
+	struct segment *seg;
+	uint8_t *map;
+
+	map = seg_map();
+	if (!map) {
+		fprintf(stderr, "Failed to create scrollback segment in %s: %s\n",
+		        tmpdir, strerror(errno));
+		disabled = 1;
+		return NULL;
+	}
+
+	if (segs_cnt == segs_max) {
+		munmap(seg_at(0)->map, SCROLLBACK_SEGMENT_SIZE);
+		segs_first = (segs_first + 1) % segs_max;
+		segs_cnt--;
+	}
+
+	seg = seg_at(segs_cnt++);
+
+	seg->map = map;
+	seg->used = 0;
+	seg->blocks = 0;
+	seg->lines = 0;
+	seg->first_line = total_lines;
+
+	if (segs_cnt > HOT_SEGMENTS)
+		seg_pageout(seg_at(segs_cnt - HOT_SEGMENTS - 1));
+
+	return seg;
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t val)
+{
+	while (val >= 0x80) {
+		*(p++) = val | 0x80;
+		val >>= 7;
+	}
+
+	*(p++) = val;
+
+	return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, uint32_t *val)
+{
+	uint32_t ret = 0;
+	int shift = 0;
+
+	while (*p & 0x80) {
+		ret |= (uint32_t)(*(p++) & 0x7f) << shift;
+		shift += 7;
+	}
+
+	*val = ret | (uint32_t)*(p++) << shift;
+
+	return p;
+}
+
+static int cell_blank(const struct grid_cell *cell)
+{
+	uint32_t ch = cell->ch;
+
+	return (ch == 0 || ch == ' ') && cell->bg == blank.bg;
+}
+
+static int same_span(const struct grid_cell *a, const struct grid_cell *b)
+{
+	return (a->ch & ~GRID_CH_MASK) == (b->ch & ~GRID_CH_MASK) &&
+	       a->fg == b->fg && a->bg == b->bg;
+}
+
+/*
+ * Encodes cells as spans of the same attributes, returns the size.
+ */
+static size_t encode_spans(const struct grid_cell *cells, int ncells, uint8_t *buf)
+{
+	uint8_t *p = buf;
+	int col = 0;
+
+	while (col < ncells) {
+		const struct grid_cell *first = &cells[col];
+		int len = 1;
+
+		while (col + len < ncells && same_span(first, &cells[col + len]))
+			len++;
+
+		p = put_varint(p, len);
+		*(p++) = first->fg;
+		*(p++) = first->bg;
+		p = put_varint(p, first->ch >> 21);
+
+		for (; len; len--, col++)
+			p = put_varint(p, grid_cell_ch(&cells[col]));
+	}
+
+	return p - buf;
+}
+
+void scrollback_push(const struct grid_cell *cells, int cols)
+{
+	uint8_t buf[cols * (SPAN_MAX + CH_MAX)];
+	uint8_t hdr[2 * VARINT_MAX];
+	size_t size, hdr_size;
+	struct segment *seg;
+	int ncells = cols;
+
+	if (!segs || disabled)
+		return;
+
+	while (ncells && cell_blank(&cells[ncells-1]))
+		ncells--;
+
+	size = encode_spans(cells, ncells, buf);
+	hdr_size = put_varint(put_varint(hdr, cols), size) - hdr;
+
+	seg = segs_cnt ? seg_at(segs_cnt - 1) : NULL;
+
+	if (!seg || !seg_fits(seg, hdr_size + size)) {
+		seg = seg_new();
+		if (!seg)
+			return;
+	}
+
+	if (!(seg->lines % BLOCK_LINES))
+		*seg_idx(seg, seg->blocks++) = seg->used;
+
+	memcpy(seg->map + seg->used, hdr, hdr_size);
+	memcpy(seg->map + seg->used + hdr_size, buf, size);
+
+	seg->used += hdr_size + size;
+	seg->lines++;
+	total_lines++;
+}
+
+size_t scrollback_lines(void)
+{
+	if (!segs_cnt)
+		return 0;
+
+	return total_lines - seg_at(0)->first_line;
+}
+
+uint64_t scrollback_pushed(void)
+{
+	return total_lines;
+}
+
+int scrollback_line(size_t line, struct grid_cell *cells, int cols)
+{
+	const struct segment *seg;
+	const uint8_t *p, *end;
+	uint32_t line_cols, size, n, i;
+	uint64_t abs;
+	int col = 0;
+
+	if (line >= scrollback_lines())
+		return -1;
+
+	abs = total_lines - 1 - line;
+
+	for (i = segs_cnt; i > 1; i--) {
+		if (seg_at(i - 1)->first_line <= abs)
+			break;
+	}
+
+	seg = seg_at(i - 1);
+
+	n = abs - seg->first_line;
+	p = seg->map + *seg_idx(seg, n / BLOCK_LINES);
+
+	for (i = 0; i < n % BLOCK_LINES; i++) {
+		p = get_varint(p, &line_cols);
+		p = get_varint(p, &size);
+		p += size;
+	}
+
+	p = get_varint(p, &line_cols);
+	p = get_varint(p, &size);
+	end = p + size;
+
+	while (p < end) {
+		uint32_t len, attr, ch;
+		uint8_t fg, bg;
+
+		p = get_varint(p, &len);
+		fg = *(p++);
+		bg = *(p++);
+		p = get_varint(p, &attr);
+
+		for (; len; len--) {
+			p = get_varint(p, &ch);
+
+			if (col >= cols)
+				continue;
+
+			cells[col].ch = ch | attr << 21;
+			cells[col].fg = fg;
+			cells[col].bg = bg;
+			col++;
+		}
+	}
+
+	for (; col < cols; col++)
+		cells[col] = blank;
+
+	return line_cols;
+}
+
+int scrollback_init(size_t max_size, uint8_t default_fg, uint8_t default_bg)
+{
+	blank.ch = 0;
+	blank.fg = default_fg;
+	blank.bg = default_bg;
+
+	tmpdir = getenv("TMPDIR");
+	if (!tmpdir || !tmpdir[0])
+		tmpdir = "/var/tmp";
+
+	segs_max = max_size / SCROLLBACK_SEGMENT_SIZE;
+	if (segs_max < HOT_SEGMENTS)
+		segs_max = HOT_SEGMENTS;
+
+	segs = mem_alloc(MEM_SCROLLBACK, sizeof(struct segment) * segs_max);
+	if (!segs)
+		return -1;
+
+	return 0;
+}
+
+void scrollback_exit(void)
+{
+	unsigned int i;
+
+	if (!segs)
+		return;
+
+	for (i = 0; i < segs_cnt; i++)
+		munmap(seg_at(i)->map, SCROLLBACK_SEGMENT_SIZE);
+
+	mem_free(segs);
+	segs = NULL;
+	segs_cnt = 0;
+}
+
+void scrollback_report(FILE *f)
+{
+	size_t used = 0;
+	unsigned int i;
+
+	for (i = 0; i < segs_cnt; i++)
+		used += seg_at(i)->used;
+
+	fprintf(f, "Scrollback: %zu lines, %zu kB in %u/%u segments in %s\n",
+	        scrollback_lines(), used / 1024, segs_cnt, segs_max,
+	        tmpdir ? tmpdir : "-");
+}
@@ -0,0 +1,80 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Scrollback history spilled to disk.
+
+   Lines pushed off the top of the screen are compressed and appended to fixed
+   size segments, each segment is a file mapped into the memory. The file is
+   created in a private temporary directory and both are removed right after
+   the file has been opened, so there is nothing left behind on exit or crash.
+
+   Only the most recent segments are kept resident, older segments are paged
+   out and the kernel pages them back in on demand once they are read. When the
+   size cap is reached the oldest segment is dropped.
+
+   Each line is stored as spans of cells with the same colors and attributes,
+   the characters are variable length encoded and trailing blank cells are
+   dropped. Every 64th line offset is stored at the end of the segment so that
+   any line can be found without decoding the whole segment.
+
+  */
+
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "grid.h"
+
+#define SCROLLBACK_SEGMENT_SIZE (1024 * 1024)
+
+/*
+ * Sets up the scrollback, segments are created on demand in $TMPDIR or in
+ * /var/tmp. The max_size is rounded down to segments.
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int scrollback_init(size_t max_size, uint8_t default_fg, uint8_t default_bg);
+
+/*
+ * Unmaps all segments.
+ */
+void scrollback_exit(void);
+
+/*
+ * Appends a line that scrolled off the screen.
+ */
+void scrollback_push(const struct grid_cell *cells, int cols);
+
+/*
+ * Returns number of lines in the scrollback.
+ */
+size_t scrollback_lines(void);
+
+/*
+ * Returns number of lines pushed since the start, i.e. the absolute number of
+ * the next line. Line n in scrollback_line() is absolute line pushed - 1 - n.
+ */
+uint64_t scrollback_pushed(void);
+
+/*
+ * Decodes a line, 0 is the most recent line. The cells past the stored line
+ * are filled with blanks.
+ *
+ * Returns the number of columns the line was pushed with, -1 if the line is
+ * not in the scrollback.
+ */
+int scrollback_line(size_t line, struct grid_cell *cells, int cols);
+
+/*
+ * Prints the scrollback size.
+ */
+void scrollback_report(FILE *f);
+
+#endif /* SCROLLBACK_H */
@@ -0,0 +1,817 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <regex.h>
+#include <gfxprim.h>
+
+#include "mem.h"
+#include "search.h"
+
+#define CHUNK_SIZE (64 * 1024)
+#define MAX_QUERY 256
+#define MAX_HISTORY_MATCHES 16384
+
+struct chunk {
+	uint32_t seq;
+	uint32_t used;
+	uint32_t lines;
+	uint64_t first_line;
+	/* CHUNK_SIZE + 1, always zero terminated for regexec() */
+	char *data;
+};
+
+static struct chunk *chunks;
+static unsigned int nchunks;
+static uint32_t oldest_seq;
+static uint32_t newest_seq;
+static uint64_t next_line;
+
+/*
+ * Lines stored by the caller, they are decoded into the block to be searched
+ * and into the line buffer to compare a match.
+ */
+static search_history_line hist_line;
+static search_history_range hist_range;
+static char *block;
+static char *line_buf;
+
+/* The seq is not used and off is the offset in the line for the caller lines */
+struct history_match {
+	uint64_t line;
+	uint32_t seq;
+	uint32_t off;
+};
+
+/*
+ * History candidates match the base query, that is the query prefix the
+ * history was scanned for, depth is the length of the query prefix matching
+ * at the position. Changing the query above the base just updates the depths.
+ */
+static struct history_match *hcands;
+static uint16_t *hdepth;
+static unsigned long nhcands;
+static size_t base_len;
+static int htruncated;
+
+/* Candidates that match the whole query */
+static uint32_t *hmatches;
+static unsigned long nhmatches;
+
+/* Where the history scan for the current query stopped */
+static uint32_t scan_seq;
+static uint32_t scan_off;
+static uint64_t scan_line;
+
+struct screen_match {
+	uint16_t row;
+	uint16_t start_col;
+	uint16_t end_col;
+};
+
+static struct screen_match *smatches;
+static unsigned int nsmatches;
+static unsigned int max_smatches;
+
+static search_row_text row_text;
+static int rows;
+static int cols;
+static size_t row_stride;
+static char *rows_text;
+static uint16_t *rows_len;
+static uint16_t *cols_off;
+static uint8_t *rows_dirty;
+static uint8_t *hl_changed;
+static uint8_t *hl_row;
+static uint8_t *hl_buf;
+
+uint8_t *search_hl;
+int search_hl_cols;
+
+static char query[MAX_QUERY];
+static size_t query_len;
+static int query_regex;
+static regex_t query_re;
+
+/* Index into history matches followed by screen matches */
+static unsigned long cur_match;
+
+int search_init(size_t history_size, search_row_text fetch_row)
+{
+	unsigned int i;
+
+	row_text = fetch_row;
+
+	nchunks = GP_MAX(2u, history_size / CHUNK_SIZE);
+
+	chunks = mem_alloc(MEM_SEARCH, nchunks * sizeof(*chunks));
+	hcands = mem_alloc(MEM_SEARCH, MAX_HISTORY_MATCHES * sizeof(*hcands));
+	hdepth = mem_alloc(MEM_SEARCH, MAX_HISTORY_MATCHES * sizeof(*hdepth));
+	hmatches = mem_alloc(MEM_SEARCH, MAX_HISTORY_MATCHES * sizeof(*hmatches));
+	if (!chunks || !hcands || !hdepth || !hmatches)
+		return -1;
+
+	for (i = 0; i < nchunks; i++) {
+		chunks[i].data = mem_alloc(MEM_SEARCH, CHUNK_SIZE + 1);
+		if (!chunks[i].data)
+			return -1;
+	}
+
+	return 0;
+}
+
+int search_init_lines(search_row_text fetch_row, search_history_line fetch_line,
+                      search_history_range range)
+{
+	row_text = fetch_row;
+	hist_line = fetch_line;
+	hist_range = range;
+
+	block = mem_alloc(MEM_SEARCH, CHUNK_SIZE + 1);
+	hcands = mem_alloc(MEM_SEARCH, MAX_HISTORY_MATCHES * sizeof(*hcands));
+	hdepth = mem_alloc(MEM_SEARCH, MAX_HISTORY_MATCHES * sizeof(*hdepth));
+	hmatches = mem_alloc(MEM_SEARCH, MAX_HISTORY_MATCHES * sizeof(*hmatches));
+	if (!block || !hcands || !hdepth || !hmatches)
+		return -1;
+
+	return 0;
+}
+
+static void screen_free(void)
+{
+	mem_free(rows_text);
+	mem_free(rows_len);
+	mem_free(cols_off);
+	mem_free(rows_dirty);
+	mem_free(hl_changed);
+	mem_free(hl_row);
+	mem_free(hl_buf);
+	mem_free(smatches);
+	mem_free(line_buf);
+
+	rows_text = NULL;
+	line_buf = NULL;
+	hl_buf = NULL;
+	search_hl = NULL;
+}
+
+int search_resize(int new_rows, int new_cols)
+{
+	int active = !!search_hl;
+
+	screen_free();
+
+	rows = new_rows;
+	cols = new_cols;
+	row_stride = SEARCH_BYTES_PER_COL * cols + 1;
+	max_smatches = rows * cols;
+
+	rows_text = mem_alloc(MEM_SEARCH, rows * row_stride);
+	rows_len = mem_alloc(MEM_SEARCH, rows * sizeof(*rows_len));
+	cols_off = mem_alloc(MEM_SEARCH, rows * cols * sizeof(*cols_off));
+	rows_dirty = mem_alloc(MEM_SEARCH, rows);
+	hl_changed = mem_alloc(MEM_SEARCH, rows);
+	hl_row = mem_alloc(MEM_SEARCH, cols);
+	hl_buf = mem_alloc(MEM_SEARCH, rows * cols);
+	smatches = mem_alloc(MEM_SEARCH, max_smatches * sizeof(*smatches));
+
+	if (hist_line)
+		line_buf = mem_alloc(MEM_SEARCH, row_stride);
+
+	if (!rows_text || !rows_len || !cols_off || !rows_dirty ||
+	    !hl_changed || !hl_row || !hl_buf || !smatches ||
+	    (hist_line && !line_buf)) {
+		screen_free();
+		return -1;
+	}
+
+	memset(rows_dirty, 1, rows);
+	search_hl_cols = cols;
+
+	if (active) {
+		search_hl = hl_buf;
+		search_update();
+	}
+
+	return 0;
+}
+
+static struct chunk *chunk_by_seq(uint32_t seq)
+{
+	struct chunk *c = &chunks[seq % nchunks];
+
+	if (seq - oldest_seq > newest_seq - oldest_seq)
+		return NULL;
+
+	return c->seq == seq ? c : NULL;
+}
+
+void search_push_line(const char *text, size_t len)
+{
+	struct chunk *c;
+
+	if (!chunks)
+		return;
+
+	if (len > CHUNK_SIZE - 1)
+		len = CHUNK_SIZE - 1;
+
+	c = &chunks[newest_seq % nchunks];
+
+	if (c->used + len + 1 > CHUNK_SIZE) {
+		newest_seq++;
+
+		/* Drop the oldest chunk */
+		if (newest_seq - oldest_seq >= nchunks)
+			oldest_seq++;
+
+		c = &chunks[newest_seq % nchunks];
+		c->seq = newest_seq;
+		c->used = 0;
+		c->lines = 0;
+		c->first_line = next_line;
+	}
+
+	memcpy(c->data + c->used, text, len);
+	c->used += len;
+	c->data[c->used++] = '\n';
+	c->data[c->used] = 0;
+	c->lines++;
+
+	next_line++;
+}
+
+void search_screen_damage(int start_row, int end_row)
+{
+	if (!rows_dirty)
+		return;
+
+	start_row = GP_MAX(0, start_row);
+	end_row = GP_MIN(rows, end_row);
+
+	if (start_row < end_row)
+		memset(rows_dirty + start_row, 1, end_row - start_row);
+}
+
+/*
+ * Finds next match in zero terminated buffer, returns NULL if there is none.
+ */
+static const char *find_match(const char *start, const char *p, const char *end,
+                              size_t *match_len)
+{
+	regmatch_t m;
+	int eflags;
+
+	if (!query_regex) {
+		*match_len = query_len;
+		return memmem(p, end - p, query, query_len);
+	}
+
+	for (;;) {
+		if (p >= end)
+			return NULL;
+
+		eflags = (p == start || p[-1] == '\n') ? 0 : REG_NOTBOL;
+
+		if (regexec(&query_re, p, 1, &m, eflags))
+			return NULL;
+
+		/* Skip empty matches e.g. ^ or $ */
+		if (m.rm_eo > m.rm_so) {
+			*match_len = m.rm_eo - m.rm_so;
+			return p + m.rm_so;
+		}
+
+		p += m.rm_so + 1;
+	}
+}
+
+/*
+ * Returns the length of the query prefix that matches the text, the first
+ * from bytes are known to match.
+ */
+static uint16_t text_depth(const char *text, size_t avail, size_t from)
+{
+	size_t max = GP_MIN(query_len, avail);
+
+	while (from < max && text[from] == query[from])
+		from++;
+
+	return from;
+}
+
+/*
+ * Returns the query prefix length matching at a candidate, 0 if the text is
+ * no longer in the history.
+ */
+static uint16_t match_depth(const struct history_match *m, size_t from)
+{
+	const struct chunk *c;
+	int len;
+
+	if (!hist_line) {
+		c = chunk_by_seq(m->seq);
+		if (!c)
+			return 0;
+
+		return text_depth(c->data + m->off, c->used - m->off, from);
+	}
+
+	len = hist_line(m->line, line_buf);
+	if (len < 0 || m->off > (unsigned int)len)
+		return 0;
+
+	return text_depth(line_buf + m->off, len - m->off, from);
+}
+
+/*
+ * Drops candidates that do not match the whole query so that the history
+ * scan can go on for the whole query instead of the base.
+ */
+static void rebase(void)
+{
+	unsigned long i, j = 0;
+
+	for (i = 0; i < nhcands; i++) {
+		if (hdepth[i] < query_len)
+			continue;
+
+		hcands[j] = hcands[i];
+		hdepth[j++] = hdepth[i];
+	}
+
+	nhcands = j;
+	base_len = query_len;
+}
+
+static void add_history_match(uint64_t line, uint32_t seq, uint32_t off, uint16_t depth)
+{
+	if (nhcands >= MAX_HISTORY_MATCHES && base_len < query_len)
+		rebase();
+
+	/* Keep the most recent matches */
+	if (nhcands >= MAX_HISTORY_MATCHES) {
+		unsigned long drop = MAX_HISTORY_MATCHES / 4;
+
+		memmove(hcands, hcands + drop, (nhcands - drop) * sizeof(*hcands));
+		memmove(hdepth, hdepth + drop, (nhcands - drop) * sizeof(*hdepth));
+		nhcands -= drop;
+		htruncated = 1;
+	}
+
+	hcands[nhcands].line = line;
+	hcands[nhcands].seq = seq;
+	hcands[nhcands].off = off;
+	hdepth[nhcands] = depth;
+	nhcands++;
+}
+
+/*
+ * Scans text that starts at a line boundary, seq is the chunk sequence for the
+ * history chunks, the matches in the caller lines are stored per line.
+ */
+static void scan_text(const char *data, const char *p, const char *end,
+                      uint64_t line, uint32_t seq)
+{
+	const char *counted = p;
+	const char *m;
+	size_t len;
+
+	for (;;) {
+		const char *nl;
+		uint16_t depth = MAX_QUERY;
+
+		/* The base may grow while the chunk is scanned, see rebase() */
+		if (query_regex)
+			m = find_match(data, p, end, &len);
+		else
+			m = memmem(p, end - p, query, base_len);
+
+		if (!m)
+			break;
+
+		while ((nl = memchr(counted, '\n', m - counted))) {
+			line++;
+			counted = nl + 1;
+		}
+
+		if (!query_regex)
+			depth = text_depth(m, end - m, base_len);
+
+		if (hist_line)
+			add_history_match(line, 0, m - counted, depth);
+		else
+			add_history_match(line, seq, m - data, depth);
+
+		p = m + 1;
+	}
+}
+
+static void scan_chunk(struct chunk *c, uint32_t off, uint64_t line)
+{
+	scan_text(c->data, c->data + off, c->data + c->used, line, c->seq);
+}
+
+/*
+ * Decodes the caller lines into the block and scans them, the block is
+ * searched as a whole the same way as the history chunks.
+ */
+static void scan_lines(void)
+{
+	uint64_t first, next;
+
+	hist_range(&first, &next);
+
+	if (scan_line < first)
+		scan_line = first;
+
+	while (scan_line < next) {
+		uint64_t line = scan_line;
+		size_t used = 0;
+
+		while (line < next && used + row_stride <= CHUNK_SIZE) {
+			int len = hist_line(line, block + used);
+
+			used += GP_MAX(len, 0);
+			block[used++] = '\n';
+			line++;
+		}
+
+		block[used] = 0;
+
+		scan_text(block, block, block + used, scan_line, 0);
+		scan_line = line;
+	}
+}
+
+/*
+ * Scans history lines that were added since the last scan.
+ */
+static void scan_history(void)
+{
+	uint32_t seq;
+	struct chunk *c;
+
+	if (hist_line) {
+		scan_lines();
+		return;
+	}
+
+	if (!chunks)
+		return;
+
+	if (!chunk_by_seq(scan_seq)) {
+		c = &chunks[oldest_seq % nchunks];
+		scan_seq = oldest_seq;
+		scan_off = 0;
+		scan_line = c->first_line;
+	}
+
+	for (seq = scan_seq; seq - scan_seq <= newest_seq - scan_seq; seq++) {
+		c = chunk_by_seq(seq);
+
+		if (seq == scan_seq)
+			scan_chunk(c, scan_off, scan_line);
+		else
+			scan_chunk(c, 0, c->first_line);
+	}
+
+	c = &chunks[newest_seq % nchunks];
+	scan_seq = newest_seq;
+	scan_off = c->used;
+	scan_line = next_line;
+}
+
+/*
+ * Drops matches in lines that were evicted, these are always the oldest ones.
+ */
+static void drop_evicted(void)
+{
+	uint64_t first = 0, next;
+	unsigned long i;
+
+	if (hist_line)
+		hist_range(&first, &next);
+
+	for (i = 0; i < nhcands; i++) {
+		if (hist_line ? hcands[i].line >= first : !!chunk_by_seq(hcands[i].seq))
+			break;
+	}
+
+	if (!i)
+		return;
+
+	memmove(hcands, hcands + i, (nhcands - i) * sizeof(*hcands));
+	memmove(hdepth, hdepth + i, (nhcands - i) * sizeof(*hdepth));
+	nhcands -= i;
+}
+
+/*
+ * The query changed above the base, common bytes of the old and the new query
+ * still match and only the candidates that matched all of them are compared
+ * further.
+ */
+static void refine_history(size_t common)
+{
+	unsigned long i;
+
+	for (i = 0; i < nhcands; i++) {
+		if (hdepth[i] < common)
+			continue;
+
+		hdepth[i] = match_depth(&hcands[i], common);
+	}
+}
+
+/*
+ * Collects the candidates that match the whole query.
+ */
+static void filter_history(void)
+{
+	unsigned long i;
+
+	nhmatches = 0;
+
+	for (i = 0; i < nhcands; i++) {
+		if (hdepth[i] >= query_len)
+			hmatches[nhmatches++] = i;
+	}
+}
+
+static void rescan_history(void)
+{
+	nhcands = 0;
+	htruncated = 0;
+	base_len = query_len;
+
+	if (hist_line) {
+		scan_line = 0;
+		scan_lines();
+		return;
+	}
+
+	if (!chunks)
+		return;
+
+	scan_seq = oldest_seq;
+	scan_off = 0;
+	scan_line = chunks[oldest_seq % nchunks].first_line;
+
+	scan_history();
+}
+
+static void refresh_rows(void)
+{
+	int row;
+
+	for (row = 0; row < rows; row++) {
+		if (!rows_dirty[row])
+			continue;
+
+		char *text = rows_text + row * row_stride;
+		unsigned int len = row_text(row, text, cols_off + row * cols);
+
+		text[len] = 0;
+		rows_len[row] = len;
+		rows_dirty[row] = 0;
+	}
+}
+
+/*
+ * Maps byte offset to the first column at or after the offset.
+ */
+static int byte_to_col(const uint16_t *off, unsigned int byte)
+{
+	int l = 0, r = cols;
+
+	while (l < r) {
+		int mid = (l + r) / 2;
+
+		if (off[mid] < byte)
+			l = mid + 1;
+		else
+			r = mid;
+	}
+
+	return l;
+}
+
+static void scan_screen(void)
+{
+	int row;
+
+	nsmatches = 0;
+
+	for (row = 0; row < rows; row++) {
+		const char *text = rows_text + row * row_stride;
+		const char *end = text + rows_len[row];
+		const uint16_t *off = cols_off + row * cols;
+		const char *p = text;
+		const char *m;
+		size_t len;
+
+		while ((m = find_match(text, p, end, &len))) {
+			struct screen_match *sm;
+
+			if (nsmatches >= max_smatches)
+				return;
+
+			sm = &smatches[nsmatches++];
+			sm->row = row;
+			sm->start_col = byte_to_col(off, m - text);
+			sm->end_col = GP_MIN(cols, byte_to_col(off, m - text + len));
+
+			/* The last column of a wide character */
+			while (sm->end_col < cols && off[sm->end_col] < m - text + len)
+				sm->end_col++;
+
+			p = m + 1;
+		}
+	}
+}
+
+static void build_hl(void)
+{
+	unsigned int i = 0;
+	int row;
+
+	for (row = 0; row < rows; row++) {
+		memset(hl_row, SEARCH_HL_NONE, cols);
+
+		for (; i < nsmatches && smatches[i].row == row; i++) {
+			struct screen_match *sm = &smatches[i];
+			uint8_t hl = SEARCH_HL_MATCH;
+
+			if (nhmatches + i == cur_match)
+				hl = SEARCH_HL_CURRENT;
+
+			memset(hl_row + sm->start_col, hl, sm->end_col - sm->start_col);
+		}
+
+		uint8_t *dst = hl_buf + row * cols;
+
+		if (memcmp(dst, hl_row, cols)) {
+			memcpy(dst, hl_row, cols);
+			hl_changed[row] = 1;
+		}
+	}
+}
+
+static unsigned long total_matches(void)
+{
+	return nhmatches + nsmatches;
+}
+
+void search_update(void)
+{
+	unsigned long total;
+
+	if (!search_hl || !query_len)
+		return;
+
+	drop_evicted();
+	scan_history();
+	filter_history();
+	refresh_rows();
+	scan_screen();
+
+	total = total_matches();
+	if (cur_match >= total)
+		cur_match = total ? total - 1 : 0;
+
+	build_hl();
+}
+
+int search_set_query(const char *new_query, int regex)
+{
+	size_t new_len = strlen(new_query);
+	size_t common = 0;
+	int refine;
+
+	if (new_len >= MAX_QUERY || !hl_buf)
+		return -1;
+
+	if (regex && new_len) {
+		regex_t re;
+
+		if (regcomp(&re, new_query, REG_EXTENDED | REG_NEWLINE))
+			return -1;
+
+		if (query_regex)
+			regfree(&query_re);
+
+		query_re = re;
+	} else if (query_regex) {
+		regfree(&query_re);
+	}
+
+	while (common < query_len && common < new_len && new_query[common] == query[common])
+		common++;
+
+	/* Typing and deleting reuse the candidates as long as the base is kept */
+	refine = !regex && !query_regex && !htruncated &&
+	         base_len && common >= base_len;
+
+	memcpy(query, new_query, new_len + 1);
+	query_len = new_len;
+	query_regex = regex && new_len;
+
+	search_hl = hl_buf;
+
+	if (!query_len) {
+		nhcands = 0;
+		nhmatches = 0;
+		nsmatches = 0;
+		cur_match = 0;
+		build_hl();
+		return 0;
+	}
+
+	if (refine) {
+		drop_evicted();
+		refine_history(common);
+		scan_history();
+	} else {
+		rescan_history();
+	}
+
+	filter_history();
+
+	refresh_rows();
+	scan_screen();
+
+	/* Start at the bottom of the screen */
+	cur_match = total_matches() ? total_matches() - 1 : 0;
+
+	build_hl();
+
+	return 0;
+}
+
+void search_clear(void)
+{
+	int row;
+
+	if (!hl_buf)
+		return;
+
+	for (row = 0; row < rows; row++) {
+		uint8_t *hl = hl_buf + row * cols;
+
+		if (memchr(hl, SEARCH_HL_MATCH, cols) || memchr(hl, SEARCH_HL_CURRENT, cols))
+			hl_changed[row] = 1;
+	}
+
+	memset(hl_buf, 0, rows * cols);
+
+	if (query_regex)
+		regfree(&query_re);
+
+	query_regex = 0;
+	query_len = 0;
+	query[0] = 0;
+	nhcands = 0;
+	nhmatches = 0;
+	nsmatches = 0;
+	search_hl = NULL;
+}
+
+void search_next(int dir)
+{
+	unsigned long total = total_matches();
+
+	if (!total)
+		return;
+
+	cur_match = (cur_match + total + (dir < 0 ? -1 : 1)) % total;
+
+	build_hl();
+}
+
+int search_row_hl_changed(int row)
+{
+	int ret;
+
+	if (!hl_changed)
+		return 0;
+
+	ret = hl_changed[row];
+	hl_changed[row] = 0;
+
+	return ret;
+}
+
+void search_status(struct search_status *status)
+{
+	status->history_matches = nhmatches;
+	status->screen_matches = nsmatches;
+	status->truncated = htruncated;
+	status->current = total_matches() ? cur_match + 1 : 0;
+	status->current_line = -1;
+
+	if (cur_match < nhmatches)
+		status->current_line = hcands[hmatches[cur_match]].line;
+}
@@ -0,0 +1,145 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Incremental search over the screen and the history.
+
+   The history lines are kept as UTF-8 text in fixed size chunks, allocated
+   upfront, that are searched with memmem() or regexec() as a whole. Once the
+   chunks are full the oldest chunk is dropped.
+
+   When the lines are stored elsewhere, i.e. in the scrollback, there is no
+   text copy, the lines are fetched with a callback and decoded into a chunk
+   sized block that is searched the same way.
+
+   Screen rows are converted to text lazily, only rows that were damaged since
+   the last search are fetched again.
+
+   Plain text queries are incremental in both directions. The history is
+   scanned for a base query, the query at the time of the scan, and each
+   position that matches it records how long prefix of the current query
+   matches there. Typing or deleting characters while the query starts with
+   the base only updates these lengths. Queries shorter than the base, and
+   queries that match more positions than there is room for, rescan the
+   history.
+
+   Regular expressions are not incremental, every change of the query rescans
+   the whole history.
+
+  */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fetches screen row as UTF-8 text, one character per column, stores byte
+ * offset of each column into col_off. Returns the text length.
+ *
+ * The buffer is SEARCH_BYTES_PER_COL * cols long.
+ */
+typedef unsigned int (*search_row_text)(int row, char *buf, uint16_t *col_off);
+
+#define SEARCH_BYTES_PER_COL 4
+
+int search_init(size_t history_size, search_row_text row_text);
+
+/*
+ * Fetches history line as UTF-8 text, line is the absolute line number.
+ * Returns the text length, -1 if the line is no longer stored.
+ *
+ * The buffer is SEARCH_BYTES_PER_COL * cols long.
+ */
+typedef int (*search_history_line)(uint64_t line, char *buf);
+
+/*
+ * Returns the stored history lines as [first, next) absolute line numbers.
+ */
+typedef void (*search_history_range)(uint64_t *first, uint64_t *next);
+
+/*
+ * Initializes search over history lines stored by the caller, the
+ * search_push_line() is not used then.
+ */
+int search_init_lines(search_row_text row_text, search_history_line history_line,
+                      search_history_range history_range);
+
+/*
+ * Reallocates the screen row caches.
+ */
+int search_resize(int rows, int cols);
+
+/*
+ * Appends a line that scrolled off the screen into the history.
+ */
+void search_push_line(const char *text, size_t len);
+
+/*
+ * Marks screen rows as changed.
+ */
+void search_screen_damage(int start_row, int end_row);
+
+/*
+ * Sets new query, returns -1 on invalid regular expression.
+ */
+int search_set_query(const char *query, int regex);
+
+/*
+ * Re-evaluates the query for rows that changed since the last call.
+ */
+void search_update(void);
+
+/*
+ * Stops the search and clears all the matches.
+ */
+void search_clear(void);
+
+/*
+ * Moves the current match, dir < 0 towards the history.
+ */
+void search_next(int dir);
+
+enum search_hl {
+	SEARCH_HL_NONE,
+	SEARCH_HL_MATCH,
+	SEARCH_HL_CURRENT,
+};
+
+/*
+ * Returns non-zero if row highlight changed since the last call.
+ */
+int search_row_hl_changed(int row);
+
+struct search_status {
+	unsigned long history_matches;
+	unsigned long screen_matches;
+	/* 1-based index of the current match, 0 if there are none */
+	unsigned long current;
+	/* absolute history line of the current match, -1 on screen */
+	long long current_line;
+	int truncated;
+};
+
+void search_status(struct search_status *status);
+
+/* Highlight map, NULL when search is not active */
+extern uint8_t *search_hl;
+extern int search_hl_cols;
+
+/*
+ * Returns highlight for a screen cell.
+ */
+static inline enum search_hl search_cell_hl(int row, int col)
+{
+	if (!search_hl)
+		return SEARCH_HL_NONE;
+
+	return search_hl[row * search_hl_cols + col];
+}
+
+#endif /* SEARCH_H */
@@ -0,0 +1,181 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+#include "shm_export.h"
+
+#define PIXELS_ALIGN 64
+
+static struct shm_fb_header *hdr;
+static size_t map_size;
+static int shm_fd = -1;
+static char shm_name[256];
+
+static size_t pixels_offset(void)
+{
+	return (sizeof(struct shm_fb_header) + PIXELS_ALIGN - 1) & ~(size_t)(PIXELS_ALIGN - 1);
+}
+
+static int shm_map(size_t size)
+{
+	void *map;
+
+	if (size <= map_size)
+		return 0;
+
+	if (ftruncate(shm_fd, size)) {
+		fprintf(stderr, "ftruncate(%s): %s\n", shm_name, strerror(errno));
+		return -1;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "mmap(%s): %s\n", shm_name, strerror(errno));
+		return -1;
+	}
+
+	if (hdr)
+		munmap(hdr, map_size);
+
+	hdr = map;
+	map_size = size;
+
+	return 0;
+}
+
+static void copy_rect(const gp_pixmap *pixmap, gp_coord x, gp_coord y,
+                      gp_size w, gp_size h)
+{
+	unsigned int bpp = gp_pixel_size(pixmap->pixel_type);
+	size_t start = (size_t)x * bpp / 8;
+	size_t end = ((size_t)(x + w) * bpp + 7) / 8;
+	uint8_t *dst = (uint8_t*)hdr + hdr->pixels_offset;
+	gp_coord row;
+
+	for (row = y; row < y + (gp_coord)h; row++) {
+		size_t off = (size_t)row * pixmap->bytes_per_row;
+
+		memcpy(dst + off + start, pixmap->pixels + off + start, end - start);
+	}
+}
+
+static void publish(gp_coord x, gp_coord y, gp_size w, gp_size h)
+{
+	uint64_t seq = hdr->seq + 1;
+	struct shm_fb_rect *rect = &hdr->ring[seq % SHM_FB_RING_SIZE];
+
+	__atomic_store_n(&rect->seq, 0, __ATOMIC_RELEASE);
+	/* Orders the invalidation before the field stores that follow */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	rect->time_us = stats_time_us();
+	rect->x = x;
+	rect->y = y;
+	rect->w = w;
+	rect->h = h;
+
+	__atomic_store_n(&rect->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->seq, seq, __ATOMIC_RELEASE);
+}
+
+void shm_export_rect(const gp_pixmap *pixmap, gp_coord x, gp_coord y,
+                     gp_size w, gp_size h)
+{
+	if (!hdr)
+		return;
+
+	if (x < 0 || y < 0 || x + w > hdr->w || y + h > hdr->h)
+		return;
+
+	copy_rect(pixmap, x, y, w, h);
+	publish(x, y, w, h);
+}
+
+int shm_export_resize(const gp_pixmap *pixmap)
+{
+	size_t size = pixels_offset() + (size_t)pixmap->bytes_per_row * pixmap->h;
+
+	if (shm_fd < 0)
+		return -1;
+
+	__atomic_store_n(&hdr->geom_seq, hdr->geom_seq + 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (shm_map(size)) {
+		hdr->w = 0;
+		hdr->h = 0;
+		__atomic_store_n(&hdr->geom_seq, hdr->geom_seq + 1, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	hdr->w = pixmap->w;
+	hdr->h = pixmap->h;
+	hdr->bytes_per_row = pixmap->bytes_per_row;
+	hdr->pixel_type = pixmap->pixel_type;
+	hdr->pixels_offset = pixels_offset();
+	hdr->size = map_size;
+
+	__atomic_store_n(&hdr->geom_seq, hdr->geom_seq + 1, __ATOMIC_RELEASE);
+
+	shm_export_rect(pixmap, 0, 0, pixmap->w, pixmap->h);
+
+	return 0;
+}
+
+int shm_export_init(const char *name, const gp_pixmap *pixmap)
+{
+	if (pixmap->axes_swap || pixmap->x_swap || pixmap->y_swap) {
+		fprintf(stderr, "Framebuffer export does not support rotation\n");
+		return -1;
+	}
+
+	snprintf(shm_name, sizeof(shm_name), "%s", name);
+
+	shm_fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (shm_fd < 0) {
+		fprintf(stderr, "shm_open(%s): %s\n", shm_name, strerror(errno));
+		return -1;
+	}
+
+	if (shm_map(pixels_offset())) {
+		shm_export_exit();
+		return -1;
+	}
+
+	hdr->magic = SHM_FB_MAGIC;
+	hdr->version = SHM_FB_VERSION;
+
+	if (shm_export_resize(pixmap)) {
+		shm_export_exit();
+		return -1;
+	}
+
+	fprintf(stderr, "Exporting framebuffer to %s\n", shm_name);
+
+	return 0;
+}
+
+void shm_export_exit(void)
+{
+	if (shm_fd < 0)
+		return;
+
+	if (hdr)
+		munmap(hdr, map_size);
+
+	hdr = NULL;
+	map_size = 0;
+
+	close(shm_fd);
+	shm_fd = -1;
+	shm_unlink(shm_name);
+}
@@ -0,0 +1,95 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Framebuffer export over POSIX shared memory.
+
+   The segment starts with a header followed by the pixels. Each update is
+   copied into the segment and published into a ring of dirty rectangles
+   with a sequence number. There is a single producer and any number of
+   readers, no locks are taken.
+
+   Publishing a rectangle:
+
+     - the pixels are copied
+     - ring[seq % SHM_FB_RING_SIZE].seq is set to 0
+     - x, y, w, h and the timestamp are written
+     - ring[seq % SHM_FB_RING_SIZE].seq is set to seq
+     - header seq is set to seq
+
+   A reader that has processed rectangles up to last_seq reads the header seq
+   and then the ring entries from last_seq + 1. An entry is valid only if its
+   seq matches both before and after reading it, otherwise, or if the reader
+   lags more than SHM_FB_RING_SIZE entries behind, it has to reread the whole
+   frame.
+
+   The geometry is protected by geom_seq that is odd while it's being changed.
+   The segment only grows, readers have to remap it when size changed.
+
+  */
+
+#ifndef SHM_EXPORT_H
+#define SHM_EXPORT_H
+
+#include <stdint.h>
+#include <gfxprim.h>
+
+#define SHM_FB_MAGIC 0x464d5254 /* "TRMF" */
+#define SHM_FB_VERSION 1
+#define SHM_FB_RING_SIZE 256
+
+struct shm_fb_rect {
+	uint64_t seq;
+	/* CLOCK_MONOTONIC time the rectangle was flushed */
+	uint64_t time_us;
+	uint16_t x;
+	uint16_t y;
+	uint16_t w;
+	uint16_t h;
+};
+
+struct shm_fb_header {
+	uint32_t magic;
+	uint32_t version;
+
+	/* Geometry */
+	uint32_t geom_seq;
+	uint32_t w;
+	uint32_t h;
+	uint32_t bytes_per_row;
+	/* enum gp_pixel_type */
+	uint32_t pixel_type;
+	uint32_t pixels_offset;
+	uint64_t size;
+
+	/* Last published rectangle */
+	uint64_t seq;
+
+	struct shm_fb_rect ring[SHM_FB_RING_SIZE];
+};
+
+/*
+ * Creates the segment, name is passed to shm_open().
+ */
+int shm_export_init(const char *name, const gp_pixmap *pixmap);
+
+/*
+ * Updates the geometry and publishes the whole frame.
+ */
+int shm_export_resize(const gp_pixmap *pixmap);
+
+/*
+ * Copies a rectangle into the segment and publishes it.
+ */
+void shm_export_rect(const gp_pixmap *pixmap, gp_coord x, gp_coord y,
+                     gp_size w, gp_size h);
+
+/*
+ * Unlinks the segment.
+ */
+void shm_export_exit(void);
+
+#endif /* SHM_EXPORT_H */
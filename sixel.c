@@ -0,0 +1,580 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <string.h>
+#include <gfxprim.h>
+
+#include "mem.h"
+#include "grid.h"
+#include "sixel.h"
+
+#define PALETTE_SIZE 256
+#define MAX_PARAMS 5
+/* Images are cut at this number of cell rows */
+#define MAX_ROWS 512
+/* Band of six pixels may cross the strip end */
+#define BAND 6
+
+struct rgb {
+	uint8_t r, g, b;
+};
+
+/* VT340 default color registers, in percent */
+static const struct rgb default_palette[16] = {
+	{ 0,  0,  0}, {20, 20, 80}, {80, 13, 13}, {20, 80, 20},
+	{80, 20, 80}, {20, 80, 80}, {80, 80, 20}, {53, 53, 53},
+	{26, 26, 26}, {33, 33, 60}, {60, 26, 26}, {33, 60, 33},
+	{60, 33, 60}, {33, 60, 60}, {60, 60, 33}, {80, 80, 80},
+};
+
+/* Tile cache */
+static uint8_t *cache;
+static uint32_t slots;
+static size_t slot_size;
+static uint32_t next_tile;
+/*
+ * Tile ids wrap at a multiple of slots that fits into the grid cell so that
+ * the id to slot mapping does not jump at the wrap.
+ */
+static uint32_t tile_ids;
+static gp_pixel_type pixel_type;
+static unsigned int cw, ch;
+static struct rgb bg;
+
+enum state {
+	STATE_DATA,
+	STATE_COLOR,
+	STATE_REPEAT,
+	STATE_RASTER,
+};
+
+/* Decoder */
+static struct decoder {
+	enum state state;
+	unsigned int params[MAX_PARAMS];
+	unsigned int nparams;
+
+	struct rgb palette[PALETTE_SIZE];
+	struct rgb color;
+	unsigned int repeat;
+
+	/* Current position, band_y is relative to the image */
+	unsigned int x;
+	unsigned int band_y;
+
+	/* Strip of RGB pixels starting at strip_y, ch + BAND rows high */
+	uint8_t *strip;
+	unsigned int strip_w;
+	/* Width the buffers are allocated for, they are reused between images */
+	unsigned int alloc_w;
+	unsigned int strip_y;
+	/* Pixels written into the strip */
+	unsigned int used_w;
+	unsigned int used_h;
+
+	/* Error diffusion for grayscale, current and next row */
+	int16_t *err[2];
+
+	unsigned int rows;
+	uint32_t row_first[MAX_ROWS];
+	uint16_t row_tiles[MAX_ROWS];
+
+	/* Set while an image is being decoded */
+	int active;
+} dec;
+
+static uint8_t pct(unsigned int val)
+{
+	return val >= 100 ? 255 : val * 255 / 100;
+}
+
+static uint8_t hue_channel(int m1, int m2, int h)
+{
+	int v;
+
+	h = (h + 360) % 360;
+
+	if (h < 60)
+		v = m1 + (m2 - m1) * h / 60;
+	else if (h < 180)
+		v = m2;
+	else if (h < 240)
+		v = m1 + (m2 - m1) * (240 - h) / 60;
+	else
+		v = m1;
+
+	return v * 255 / 100;
+}
+
+/*
+ * Sixel HLS has blue at 0 degrees, red at 120 and green at 240.
+ */
+static struct rgb hls_to_rgb(unsigned int h, unsigned int l, unsigned int s)
+{
+	struct rgb ret;
+	int m1, m2;
+
+	h = (h + 240) % 360;
+	l = GP_MIN(l, 100u);
+	s = GP_MIN(s, 100u);
+
+	if (!s) {
+		ret.r = ret.g = ret.b = pct(l);
+		return ret;
+	}
+
+	m2 = l <= 50 ? l * (100 + s) / 100 : l + s - l * s / 100;
+	m1 = 2 * l - m2;
+
+	ret.r = hue_channel(m1, m2, h + 120);
+	ret.g = hue_channel(m1, m2, h);
+	ret.b = hue_channel(m1, m2, h - 120);
+
+	return ret;
+}
+
+static uint8_t *tile_addr(uint32_t tile)
+{
+	return cache + (size_t)(tile % slots) * slot_size;
+}
+
+static void tile_pixmap(gp_pixmap *pixmap, uint32_t tile)
+{
+	gp_pixmap_init(pixmap, cw, ch, pixel_type, tile_addr(tile), 0);
+}
+
+static int tile_valid(uint32_t tile)
+{
+	uint32_t age;
+
+	if (tile >= tile_ids)
+		return 0;
+
+	age = (next_tile + tile_ids - tile) % tile_ids;
+
+	return age >= 1 && age <= slots;
+}
+
+static void strip_clear(unsigned int start_row, unsigned int end_row)
+{
+	size_t row_size = (size_t)dec.strip_w * 3;
+	unsigned int row, x;
+
+	for (row = start_row; row < end_row; row++) {
+		uint8_t *p = dec.strip + row * row_size;
+
+		for (x = 0; x < dec.strip_w; x++) {
+			*(p++) = bg.r;
+			*(p++) = bg.g;
+			*(p++) = bg.b;
+		}
+	}
+}
+
+/*
+ * Floyd-Steinberg to the gray levels of the backend, the error is carried over
+ * to the next strip so that there are no seams between the cell rows.
+ */
+static gp_pixel dither(unsigned int x, int lum)
+{
+	unsigned int levels = 1u << gp_pixel_size(pixel_type);
+	int step = 255 / (levels - 1);
+	int v = lum + dec.err[0][x];
+	int q = GP_MIN(GP_MAX((v + step / 2) / step, 0), (int)levels - 1);
+	int e = v - q * step;
+
+	if (x + 1 < dec.strip_w) {
+		dec.err[0][x + 1] += e * 7 / 16;
+		dec.err[1][x + 1] += e / 16;
+	}
+
+	if (x > 0)
+		dec.err[1][x - 1] += e * 3 / 16;
+
+	dec.err[1][x] += e * 5 / 16;
+
+	return gp_rgb_to_pixel(q * step, q * step, q * step, pixel_type);
+}
+
+/*
+ * Converts the top cell row of the strip into tiles.
+ */
+static void strip_flush(void)
+{
+	unsigned int tiles = GP_MIN((dec.used_w + cw - 1) / cw, dec.strip_w / cw);
+	int gray = gp_pixel_size(pixel_type) < 8;
+	unsigned int x, y;
+	gp_pixmap tile;
+
+	if (dec.rows >= MAX_ROWS || !slots)
+		return;
+
+	/* Tiles in a row have consecutive ids, see grid_put_tiles() */
+	if (next_tile + tiles > tile_ids)
+		next_tile = 0;
+
+	dec.row_first[dec.rows] = next_tile;
+	dec.row_tiles[dec.rows] = tiles;
+	dec.rows++;
+
+	for (y = 0; y < ch; y++) {
+		const uint8_t *p = dec.strip + (size_t)y * dec.strip_w * 3;
+		struct rgb last = {0, 0, 0};
+		gp_pixel last_pix = gp_rgb_to_pixel(0, 0, 0, pixel_type);
+
+		for (x = 0; x < tiles * cw; x++, p += 3) {
+			gp_pixel pix;
+
+			if (gray) {
+				pix = dither(x, (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+			} else if (p[0] == last.r && p[1] == last.g && p[2] == last.b) {
+				pix = last_pix;
+			} else {
+				last = (struct rgb){p[0], p[1], p[2]};
+				pix = last_pix = gp_rgb_to_pixel(p[0], p[1], p[2], pixel_type);
+			}
+
+			if (x % cw == 0)
+				tile_pixmap(&tile, next_tile + x / cw);
+
+			gp_putpixel(&tile, x % cw, y, pix);
+		}
+
+		if (gray) {
+			int16_t *tmp = dec.err[0];
+
+			dec.err[0] = dec.err[1];
+			dec.err[1] = tmp;
+			memset(dec.err[1], 0, sizeof(int16_t) * dec.strip_w);
+		}
+	}
+
+	next_tile = (next_tile + tiles) % tile_ids;
+}
+
+/*
+ * Moves the strip down by a cell row.
+ */
+static void strip_advance(void)
+{
+	size_t row_size = (size_t)dec.strip_w * 3;
+
+	strip_flush();
+
+	memmove(dec.strip, dec.strip + ch * row_size, BAND * row_size);
+	strip_clear(BAND, ch + BAND);
+
+	dec.strip_y += ch;
+	dec.used_h = dec.used_h > ch ? dec.used_h - ch : 0;
+}
+
+static void put_sixel(unsigned int bits)
+{
+	unsigned int y0 = dec.band_y - dec.strip_y;
+	unsigned int n = dec.repeat ? dec.repeat : 1;
+	unsigned int i, b, top;
+
+	dec.repeat = 0;
+
+	if (!bits) {
+		dec.x += n;
+		return;
+	}
+
+	top = 32 - __builtin_clz(bits);
+
+	for (i = 0; i < n && dec.x < dec.strip_w; i++, dec.x++) {
+		for (b = 0; b < BAND; b++) {
+			uint8_t *p;
+
+			if (!(bits & (1u << b)))
+				continue;
+
+			p = dec.strip + ((size_t)(y0 + b) * dec.strip_w + dec.x) * 3;
+			p[0] = dec.color.r;
+			p[1] = dec.color.g;
+			p[2] = dec.color.b;
+		}
+
+		dec.used_w = GP_MAX(dec.used_w, dec.x + 1);
+		dec.used_h = GP_MAX(dec.used_h, y0 + top);
+	}
+
+	dec.x += n - i;
+}
+
+static void next_band(void)
+{
+	dec.x = 0;
+	dec.band_y += BAND;
+
+	while (dec.band_y >= dec.strip_y + ch)
+		strip_advance();
+}
+
+static void color_cmd(void)
+{
+	unsigned int reg = dec.params[0] % PALETTE_SIZE;
+
+	if (dec.nparams >= 5) {
+		switch (dec.params[1]) {
+		case 1:
+			dec.palette[reg] = hls_to_rgb(dec.params[2], dec.params[3], dec.params[4]);
+		break;
+		case 2:
+			dec.palette[reg].r = pct(dec.params[2]);
+			dec.palette[reg].g = pct(dec.params[3]);
+			dec.palette[reg].b = pct(dec.params[4]);
+		break;
+		}
+	}
+
+	dec.color = dec.palette[reg];
+}
+
+static int param_char(char c)
+{
+	if (c >= '0' && c <= '9') {
+		unsigned int *p = &dec.params[dec.nparams ? dec.nparams - 1 : 0];
+
+		if (!dec.nparams)
+			dec.nparams = 1;
+
+		if (*p < 100000)
+			*p = *p * 10 + c - '0';
+
+		return 1;
+	}
+
+	if (c == ';') {
+		if (!dec.nparams)
+			dec.nparams = 1;
+
+		if (dec.nparams < MAX_PARAMS)
+			dec.params[dec.nparams++] = 0;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static void params_start(enum state state)
+{
+	dec.state = state;
+	dec.nparams = 0;
+	memset(dec.params, 0, sizeof(dec.params));
+}
+
+void sixel_data(const char *buf, size_t len)
+{
+	size_t i;
+
+	if (!dec.active)
+		return;
+
+	for (i = 0; i < len; i++) {
+		char c = buf[i];
+
+		if (dec.state != STATE_DATA) {
+			if (param_char(c))
+				continue;
+
+			switch (dec.state) {
+			case STATE_COLOR:
+				color_cmd();
+			break;
+			case STATE_REPEAT:
+				dec.repeat = dec.params[0];
+			break;
+			/* Aspect ratio and size are not needed for drawing */
+			case STATE_RASTER:
+			case STATE_DATA:
+			break;
+			}
+
+			dec.state = STATE_DATA;
+		}
+
+		switch (c) {
+		case '#':
+			params_start(STATE_COLOR);
+		break;
+		case '!':
+			params_start(STATE_REPEAT);
+		break;
+		case '"':
+			params_start(STATE_RASTER);
+		break;
+		case '$':
+			dec.x = 0;
+		break;
+		case '-':
+			next_band();
+		break;
+		default:
+			if (c >= '?' && c <= '~')
+				put_sixel(c - '?');
+		}
+	}
+}
+
+static void dec_free(void)
+{
+	mem_free(dec.strip);
+	mem_free(dec.err[0]);
+	mem_free(dec.err[1]);
+
+	dec.strip = NULL;
+	dec.err[0] = dec.err[1] = NULL;
+	dec.alloc_w = 0;
+	dec.active = 0;
+}
+
+static int dec_alloc(unsigned int w)
+{
+	dec_free();
+
+	dec.strip = mem_alloc(MEM_IMAGE, (size_t)w * (ch + BAND) * 3);
+	if (!dec.strip)
+		return -1;
+
+	if (gp_pixel_size(pixel_type) < 8) {
+		dec.err[0] = mem_alloc(MEM_IMAGE, sizeof(int16_t) * w);
+		dec.err[1] = mem_alloc(MEM_IMAGE, sizeof(int16_t) * w);
+
+		if (!dec.err[0] || !dec.err[1]) {
+			dec_free();
+			return -1;
+		}
+	}
+
+	dec.alloc_w = w;
+
+	return 0;
+}
+
+void sixel_start(const char *params, size_t len, unsigned int max_cols)
+{
+	unsigned int i;
+
+	(void)params;
+	(void)len;
+
+	dec.active = 0;
+	dec.state = STATE_DATA;
+	dec.x = 0;
+	dec.band_y = 0;
+	dec.strip_y = 0;
+	dec.used_w = 0;
+	dec.used_h = 0;
+	dec.repeat = 0;
+	dec.rows = 0;
+	dec.strip_w = max_cols * cw;
+
+	for (i = 0; i < PALETTE_SIZE; i++) {
+		const struct rgb *c = &default_palette[i % 16];
+
+		dec.palette[i].r = pct(c->r);
+		dec.palette[i].g = pct(c->g);
+		dec.palette[i].b = pct(c->b);
+	}
+
+	dec.color = dec.palette[0];
+
+	if (!slots || !dec.strip_w)
+		return;
+
+	/* The buffers only grow so that images are decoded without allocations */
+	if (dec.strip_w > dec.alloc_w && dec_alloc(dec.strip_w)) {
+		fprintf(stderr, "Failed to allocate sixel decoder\n");
+		return;
+	}
+
+	if (dec.err[0]) {
+		memset(dec.err[0], 0, sizeof(int16_t) * dec.strip_w);
+		memset(dec.err[1], 0, sizeof(int16_t) * dec.strip_w);
+	}
+
+	dec.active = 1;
+	strip_clear(0, ch + BAND);
+}
+
+unsigned int sixel_finish(void)
+{
+	if (!dec.active)
+		return 0;
+
+	while (dec.used_h > 0)
+		strip_advance();
+
+	dec.active = 0;
+
+	return dec.rows;
+}
+
+unsigned int sixel_row(unsigned int row, uint32_t *first_tile)
+{
+	if (row >= dec.rows)
+		return 0;
+
+	*first_tile = dec.row_first[row];
+
+	return dec.row_tiles[row];
+}
+
+int sixel_draw_tile(gp_pixmap *dst, gp_coord x, gp_coord y, uint32_t tile)
+{
+	gp_pixmap src;
+
+	if (!slots || !tile_valid(tile))
+		return -1;
+
+	tile_pixmap(&src, tile);
+	gp_blit_xywh(&src, 0, 0, cw, ch, dst, x, y);
+
+	return 0;
+}
+
+int sixel_init(size_t cache_size, gp_pixel_type type,
+               unsigned int cell_w, unsigned int cell_h,
+               uint8_t bg_r, uint8_t bg_g, uint8_t bg_b)
+{
+	sixel_exit();
+
+	pixel_type = type;
+	cw = cell_w;
+	ch = cell_h;
+	bg = (struct rgb){bg_r, bg_g, bg_b};
+
+	slot_size = (size_t)(cw * gp_pixel_size(type) + 7) / 8 * ch;
+	/* At least two ids per slot so that an evicted tile never looks valid */
+	slots = GP_MIN(cache_size / slot_size, (size_t)(GRID_CH_MASK + 1) / 2);
+
+	if (!slots)
+		return 0;
+
+	tile_ids = slots * ((GRID_CH_MASK + 1) / slots);
+
+	/* Tiles placed with the previous cell size must not look valid */
+	next_tile = (next_tile % tile_ids + slots) % tile_ids;
+
+	cache = mem_alloc(MEM_IMAGE, slots * slot_size);
+	if (!cache) {
+		slots = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void sixel_exit(void)
+{
+	dec_free();
+	mem_free(cache);
+	cache = NULL;
+	slots = 0;
+	dec.rows = 0;
+}
@@ -0,0 +1,67 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Sixel images stored as cell sized tiles.
+
+   The DCS string is decoded as it arrives into a strip one cell row high,
+   once the sixel bands move past the strip it's converted into the backend
+   pixel format, dithered on grayscale backends, and cut into tiles. The image
+   is placed into the grid as cells that refer to the tiles so it scrolls along
+   with the text and only the damaged cells are redrawn.
+
+   Tiles are kept in a fixed size ring, tile ids are allocated sequentially
+   and once the ring wraps around the oldest tiles are overwritten. Cells that
+   refer to evicted tiles are drawn as background.
+
+  */
+
+#ifndef SIXEL_H
+#define SIXEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <gfxprim.h>
+
+/*
+ * Allocates the tile cache, has to be called again when the cell size
+ * changes. Empty pixels are filled with the bg color.
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int sixel_init(size_t cache_size, gp_pixel_type type,
+               unsigned int cell_w, unsigned int cell_h,
+               uint8_t bg_r, uint8_t bg_g, uint8_t bg_b);
+
+void sixel_exit(void);
+
+/*
+ * Starts decoding an image, params are the DCS parameters without the final
+ * 'q' and max_cols limits the image width.
+ */
+void sixel_start(const char *params, size_t len, unsigned int max_cols);
+
+/*
+ * Decodes a chunk of the DCS string.
+ */
+void sixel_data(const char *buf, size_t len);
+
+/*
+ * Finishes the image, returns number of cell rows.
+ */
+unsigned int sixel_finish(void);
+
+/*
+ * Returns number of tiles in a cell row of the last image and the first tile.
+ */
+unsigned int sixel_row(unsigned int row, uint32_t *first_tile);
+
+/*
+ * Draws a tile, returns -1 if the tile was evicted.
+ */
+int sixel_draw_tile(gp_pixmap *dst, gp_coord x, gp_coord y, uint32_t tile);
+
+#endif /* SIXEL_H */
@@ -0,0 +1,223 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "alloc_stats.h"
+#include "stats.h"
+
+struct stats stats;
+int stats_tracing;
+
+static uint64_t start_us;
+static unsigned long long allocs_base;
+static struct stats rates_prev;
+static uint64_t rates_prev_us;
+
+/* Key press waiting for the answer to be flushed */
+static uint64_t latency_key_us;
+static int latency_pty;
+
+void stats_start(void)
+{
+	start_us = stats_time_us();
+}
+
+void stats_allocs_start(void)
+{
+	allocs_base = alloc_stats_allocs();
+}
+
+static void allocs_update(void)
+{
+	stats.allocs = alloc_stats_allocs() - allocs_base;
+}
+
+void stats_report(FILE *f)
+{
+	double secs = (stats_time_us() - start_us) / 1000000.0;
+	unsigned long wakeups = stats_wakeups();
+	struct rusage ru;
+
+	if (secs <= 0)
+		secs = 1;
+
+	fprintf(f, "Stats after %.1fs:\n", secs);
+	fprintf(f, "  wakeups       %lu (%.2f/s)\n", wakeups, wakeups / secs);
+	fprintf(f, "    pty         %lu (%lu empty reads)\n",
+	        stats.pty_wakeups, stats.pty_empty_reads);
+	fprintf(f, "    echo path   %lu\n", stats.echo_reads);
+	fprintf(f, "    bulk path   %lu\n", stats.bulk_reads);
+	fprintf(f, "    timers      %lu\n", stats.timer_wakeups);
+	fprintf(f, "    events      %lu\n", stats.event_wakeups);
+	fprintf(f, "    render      %lu\n", stats.render_wakeups);
+	fprintf(f, "  hud wakeups   %lu\n", stats.hud_wakeups);
+	fprintf(f, "  pty bytes     %llu\n", stats.pty_bytes);
+	fprintf(f, "  pty syscalls  %llu (%.1f/MB)\n", stats.pty_syscalls,
+	        stats.pty_bytes ? stats.pty_syscalls * 1048576.0 / stats.pty_bytes : 0);
+	fprintf(f, "  fast path     %llu bytes\n", stats.fast_bytes);
+	fprintf(f, "  flushes       %lu\n", stats.flushes);
+	fprintf(f, "  cursor redraw %lu\n", stats.cursor_redraws);
+	fprintf(f, "  mouse reports %lu (%lu coalesced)\n",
+	        stats.mouse_reports, stats.mouse_coalesced);
+	fprintf(f, "  frames        %lu (%.2f/s)\n", stats.frames, stats.frames / secs);
+	fprintf(f, "  cells         %llu\n", stats.cells);
+	fprintf(f, "  update area   %llu px\n", stats.update_area);
+	fprintf(f, "  read time     %.2f us avg\n",
+	        stats.pty_wakeups ? (double)stats.read_us / stats.pty_wakeups : 0);
+	fprintf(f, "  parse time    %.2f us avg\n",
+	        stats.pty_wakeups ? (double)stats.parse_us / stats.pty_wakeups : 0);
+	fprintf(f, "  hidden        %lu reads, %llu cells damaged, %llu repainted\n",
+	        stats.hidden_reads, stats.hidden_cells, stats.resume_cells);
+	fprintf(f, "  scrollback    %llu rows drawn, %llu cached, %llu moved\n",
+	        stats.view_drawn, stats.view_cached, stats.view_moved);
+#ifdef CONFIG_ALLOC_STATS
+	allocs_update();
+	fprintf(f, "  allocations   %llu, %.2f per frame, %.2f per MB of input\n",
+	        stats.allocs, stats.frames ? (double)stats.allocs / stats.frames : 0,
+	        stats.pty_bytes ? (double)stats.allocs * 1048576 / stats.pty_bytes : 0);
+#endif
+
+	if (!getrusage(RUSAGE_SELF, &ru)) {
+		fprintf(f, "  cpu time      %.2fs user %.2fs sys\n",
+		        ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0,
+		        ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0);
+	}
+}
+
+static float per(unsigned long long val, unsigned long long div)
+{
+	return div ? (float)val / div : 0;
+}
+
+void stats_rates(struct stats_rates *rates)
+{
+	struct stats prev = rates_prev;
+	uint64_t prev_us = rates_prev_us;
+	uint64_t now = stats_time_us();
+	unsigned long frames = stats.frames - prev.frames;
+	unsigned long reads = stats.pty_wakeups - prev.pty_wakeups;
+	float secs;
+
+	if (!prev_us)
+		prev_us = start_us;
+
+	secs = (now - prev_us) / 1000000.0f;
+	if (secs <= 0)
+		secs = 1;
+
+	rates->fps = frames / secs;
+	rates->pty_bytes_per_s = (stats.pty_bytes - prev.pty_bytes) / secs;
+	rates->wakeups_per_s = (stats_wakeups() - (prev.pty_wakeups +
+	                        prev.timer_wakeups + prev.event_wakeups +
+	                        prev.render_wakeups)) / secs;
+	rates->cells_per_frame = per(stats.cells - prev.cells, frames);
+	rates->area_per_frame = per(stats.update_area - prev.update_area, frames);
+	rates->read_us = per(stats.read_us - prev.read_us, reads);
+
+	rates_prev = stats;
+	rates_prev_us = now;
+}
+
+void stats_dump(FILE *f)
+{
+	unsigned int i;
+
+	fprintf(f, "uptime_us %llu\n", (unsigned long long)(stats_time_us() - start_us));
+	fprintf(f, "pty_wakeups %lu\n", stats.pty_wakeups);
+	fprintf(f, "timer_wakeups %lu\n", stats.timer_wakeups);
+	fprintf(f, "event_wakeups %lu\n", stats.event_wakeups);
+	fprintf(f, "render_wakeups %lu\n", stats.render_wakeups);
+	fprintf(f, "hud_wakeups %lu\n", stats.hud_wakeups);
+	fprintf(f, "pty_empty_reads %lu\n", stats.pty_empty_reads);
+	fprintf(f, "pty_bytes %llu\n", stats.pty_bytes);
+	fprintf(f, "pty_syscalls %llu\n", stats.pty_syscalls);
+	fprintf(f, "fast_bytes %llu\n", stats.fast_bytes);
+	fprintf(f, "read_us %llu\n", stats.read_us);
+	fprintf(f, "parse_us %llu\n", stats.parse_us);
+	fprintf(f, "flushes %lu\n", stats.flushes);
+	fprintf(f, "cursor_redraws %lu\n", stats.cursor_redraws);
+	fprintf(f, "frames %lu\n", stats.frames);
+	fprintf(f, "cells %llu\n", stats.cells);
+	fprintf(f, "update_area %llu\n", stats.update_area);
+	fprintf(f, "echo_reads %lu\n", stats.echo_reads);
+	fprintf(f, "bulk_reads %lu\n", stats.bulk_reads);
+	fprintf(f, "mouse_reports %lu\n", stats.mouse_reports);
+	fprintf(f, "mouse_coalesced %lu\n", stats.mouse_coalesced);
+	fprintf(f, "hidden_reads %lu\n", stats.hidden_reads);
+	fprintf(f, "hidden_cells %llu\n", stats.hidden_cells);
+	fprintf(f, "resume_cells %llu\n", stats.resume_cells);
+	fprintf(f, "view_drawn %llu\n", stats.view_drawn);
+	fprintf(f, "view_cached %llu\n", stats.view_cached);
+	fprintf(f, "view_moved %llu\n", stats.view_moved);
+#ifdef CONFIG_ALLOC_STATS
+	allocs_update();
+	fprintf(f, "allocs %llu\n", stats.allocs);
+#endif
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS - 1; i++)
+		fprintf(f, "latency_us_lt_%u %lu\n", 64u << i, stats.latency_hist[i]);
+
+	fprintf(f, "latency_us_inf %lu\n", stats.latency_hist[i]);
+}
+
+void stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	memset(&rates_prev, 0, sizeof(rates_prev));
+
+	allocs_base = alloc_stats_allocs();
+
+	start_us = stats_time_us();
+	rates_prev_us = 0;
+	latency_key_us = 0;
+}
+
+void stats_trace(const char *fmt, ...)
+{
+	va_list va;
+
+	fprintf(stderr, "%10.6f ", (stats_time_us() - start_us) / 1000000.0);
+
+	va_start(va, fmt);
+	vfprintf(stderr, fmt, va);
+	va_end(va);
+}
+
+void stats_latency_key(void)
+{
+	if (latency_key_us)
+		return;
+
+	latency_key_us = stats_time_us();
+	latency_pty = 0;
+}
+
+void stats_latency_pty(void)
+{
+	if (latency_key_us)
+		latency_pty = 1;
+}
+
+void stats_latency_flush(void)
+{
+	uint64_t us;
+	unsigned int i = 0;
+
+	if (!latency_key_us || !latency_pty)
+		return;
+
+	us = stats_time_us() - latency_key_us;
+
+	while (i < STATS_LATENCY_BUCKETS - 1 && us >= (64u << i))
+		i++;
+
+	stats.latency_hist[i]++;
+	latency_key_us = 0;
+
+	STATS_TRACE("latency %llu us\n", (unsigned long long)us);
+}
@@ -0,0 +1,153 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Runtime counters.
+
+  */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Key to screen latency histogram, bucket i counts latencies below 64us << i */
+#define STATS_LATENCY_BUCKETS 12
+
+struct stats {
+	/* Wakeups of the main loop split by the cause */
+	unsigned long pty_wakeups;
+	unsigned long timer_wakeups;
+	unsigned long event_wakeups;
+	unsigned long render_wakeups;
+	/* HUD refreshes, left out of the wakeups so that the HUD does not skew them */
+	unsigned long hud_wakeups;
+
+	/* PTY reads that returned no data */
+	unsigned long pty_empty_reads;
+	unsigned long long pty_bytes;
+
+	/* PTY read(), write() and io_uring syscalls, not counting the poll */
+	unsigned long long pty_syscalls;
+
+	/* Backend updates and cursor cell redraws */
+	unsigned long flushes;
+	unsigned long cursor_redraws;
+
+	/* Damage repaints, cells drawn and backend update area in pixels */
+	unsigned long frames;
+	unsigned long long cells;
+	unsigned long long update_area;
+
+	/* PTY reads painted by the echo and by the bulk path */
+	unsigned long echo_reads;
+	unsigned long bulk_reads;
+
+	/* Mouse reports sent to the application and motion events dropped */
+	unsigned long mouse_reports;
+	unsigned long mouse_coalesced;
+
+	/* Reads parsed and cells damaged while the drawing was suspended */
+	unsigned long hidden_reads;
+	unsigned long long hidden_cells;
+	/* Cells repainted when the window was shown again */
+	unsigned long long resume_cells;
+
+	/* Scrollback viewport rows rasterized, blitted from cache and moved */
+	unsigned long long view_drawn;
+	unsigned long long view_cached;
+	unsigned long long view_moved;
+
+	/* Bytes written into the grid by the printable ASCII fast path */
+	unsigned long long fast_bytes;
+
+	/* Time spent in console_read() and in the parser */
+	unsigned long long read_us;
+	unsigned long long parse_us;
+
+	/* Time from a key press to the first flush after the application answered */
+	unsigned long latency_hist[STATS_LATENCY_BUCKETS];
+
+	/* Heap allocations, counted only in the ALLOC_STATS build */
+	unsigned long long allocs;
+};
+
+extern struct stats stats;
+
+/* Set when trace messages are printed to stderr */
+extern int stats_tracing;
+
+#define STATS_TRACE(...) do { \
+	if (stats_tracing) \
+		stats_trace(__VA_ARGS__); \
+} while (0)
+
+void stats_trace(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static inline uint64_t stats_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline unsigned long stats_wakeups(void)
+{
+	return stats.pty_wakeups + stats.timer_wakeups + stats.event_wakeups +
+	       stats.render_wakeups;
+}
+
+/*
+ * Starts the clock the rates are computed from.
+ */
+void stats_start(void);
+
+void stats_report(FILE *f);
+
+/*
+ * Prints all counters as name value pairs, one per line.
+ */
+void stats_dump(FILE *f);
+
+/*
+ * Zeroes the counters and restarts the clock.
+ */
+void stats_reset(void);
+
+/*
+ * Starts counting heap allocations from now on, called once the startup
+ * allocations are done.
+ */
+void stats_allocs_start(void);
+
+/*
+ * Key to screen latency, a key press starts the measurement and the first
+ * flush after the PTY has produced data ends it.
+ */
+void stats_latency_key(void);
+void stats_latency_pty(void);
+void stats_latency_flush(void);
+
+struct stats_rates {
+	float fps;
+	float pty_bytes_per_s;
+	float wakeups_per_s;
+	float cells_per_frame;
+	float area_per_frame;
+	/* average console_read() time */
+	float read_us;
+};
+
+/*
+ * Computes rates since the previous call.
+ */
+void stats_rates(struct stats_rates *rates);
+
+#endif /* STATS_H */
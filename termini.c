@@ -9,20 +9,82 @@
 
   */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <poll.h>
 #include <pty.h>
 #include <errno.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <vterm.h>
 #include <gfxprim.h>
 
 #include "config.h"
 
 #include "xterm_256_palette.h"
+#include "cell_kernels.h"
+#include "mem.h"
+#include "search.h"
+#include "stats.h"
+#include "pty_uring.h"
+#include "shm_export.h"
+#include "grid.h"
+#include "scrollback.h"
+#include "sixel.h"
+#include "zoom.h"
+#include "control.h"
+#include "hints.h"
+#include "fastpath.h"
 
 #define HIDE_CURSOR_TIMEOUT 1000
 
+/*
+ * Low memory profile, all per-terminal state is allocated from a fixed size
+ * arena and the alternate screen is enabled only on request.
+ */
+#ifdef CONFIG_LOWMEM
+# ifndef CONFIG_LOWMEM_ARENA_KB
+#  define CONFIG_LOWMEM_ARENA_KB 2048
+# endif
+#else
+# define CONFIG_LOWMEM_ARENA_KB 0
+#endif
+
+/* Upper estimate of the libvterm per cell storage, used to fit into arena */
+#define VTERM_CELL_SIZE 40
+
+#ifdef CONFIG_LOWMEM
+# define SEARCH_HISTORY_KB 256
+#else
+# define SEARCH_HISTORY_KB 4096
+#endif
+
+/* Disk spilled scrollback size cap, the low memory profile keeps it disabled */
+#ifdef CONFIG_LOWMEM
+# define SCROLLBACK_MB 0
+#else
+# define SCROLLBACK_MB 64
+#endif
+
+/* Row strips cached by the scrollback viewport, in screen heights */
+#ifdef CONFIG_LOWMEM
+# define VIEW_CACHE_PAGES 0
+#else
+# define VIEW_CACHE_PAGES 2
+#endif
+
+/* Sixel image tile cache size */
+#ifdef CONFIG_LOWMEM
+# define IMAGE_CACHE_KB 256
+#else
+# define IMAGE_CACHE_KB 16384
+#endif
+
 static gp_backend *backend;
 
 static VTerm *vt;
@@ -32,8 +94,8 @@ static unsigned int cols;
 static unsigned int rows;
 static unsigned int char_width;
 static unsigned int char_height;
-static gp_text_style *text_style;
-static gp_text_style *text_style_bold;
+static const gp_text_style *text_style;
+static const gp_text_style *text_style_bold;
 
 static gp_pixel colors[256];
 
@@ -41,6 +103,61 @@ static uint8_t fg_color_idx;
 static uint8_t bg_color_idx;
 
 static int focused = 0;
+static int is_grayscale;
+
+static int altscreen = 1;
+static int mem_report_enabled;
+static int stats_enabled;
+static int io_uring;
+static int shm_export;
+/* Cells are kept in the grid instead of the libvterm screen */
+static int grid_mode;
+static int scrollback_mb = SCROLLBACK_MB;
+static int image_cache_kb = IMAGE_CACHE_KB;
+static int sixel_enabled;
+
+enum startup_event {
+	STARTUP_FORK,
+	STARTUP_BACKEND,
+	STARTUP_TERM,
+	STARTUP_FIRST_BYTE,
+	STARTUP_FIRST_FRAME,
+	STARTUP_EVENTS,
+};
+
+static const char *startup_names[STARTUP_EVENTS] = {
+	[STARTUP_FORK] = "shell forked",
+	[STARTUP_BACKEND] = "backend ready",
+	[STARTUP_TERM] = "terminal ready",
+	[STARTUP_FIRST_BYTE] = "first PTY byte",
+	[STARTUP_FIRST_FRAME] = "first frame",
+};
+
+/* Set while --startup-profile has events to record */
+static int startup_pending;
+static uint64_t startup_us[STARTUP_EVENTS];
+static uint64_t startup_start;
+
+static void startup_mark(enum startup_event ev)
+{
+	int i;
+
+	if (startup_us[ev])
+		return;
+
+	startup_us[ev] = stats_time_us();
+
+	if (ev != STARTUP_FIRST_FRAME)
+		return;
+
+	startup_pending = 0;
+
+	fprintf(stderr, "Startup profile:\n");
+	for (i = 0; i < STARTUP_EVENTS; i++) {
+		fprintf(stderr, "  %-15s %8.2f ms\n", startup_names[i],
+		        startup_us[i] ? (startup_us[i] - startup_start) / 1000.0 : -1.0);
+	}
+}
 
 /* HACK to draw frames */
 static void draw_utf8_frames(int x, int y, uint32_t val, gp_pixel fg)
@@ -96,73 +213,216 @@ static void draw_utf8_frames(int x, int y, uint32_t val, gp_pixel fg)
 	}
 }
 
-static void draw_cell(VTermPos pos, int is_cursor)
+/*
+ * Draws a cell with already resolved attributes, may be called from the render
+ * thread with is_cursor unset and without search highlight.
+ */
+static void paint_cell(VTermPos pos, uint32_t ch, int bold, gp_pixel fg,
+                       gp_pixel bg, int is_cursor, enum search_hl hl, uint8_t hint)
 {
-	VTermScreenCell c;
-
-	vterm_screen_get_cell(vts, pos, &c);
-
-#ifdef HAVE_COLOR_INDEXED
-	gp_pixel bg = colors[c.bg.indexed.idx];
-	gp_pixel fg = colors[c.fg.indexed.idx];
-#else
-	gp_pixel bg = colors[c.bg.red];
-	gp_pixel fg = colors[c.fg.red];
-#endif
+	if (is_cursor && focused)
+		GP_SWAP(bg, fg);
 
-	if (c.attrs.reverse)
+	if (hint & HINT_SELECTED)
 		GP_SWAP(bg, fg);
 
-	if (is_cursor && focused)
+	switch (hl) {
+	case SEARCH_HL_NONE:
+	break;
+	case SEARCH_HL_MATCH:
 		GP_SWAP(bg, fg);
+	break;
+	case SEARCH_HL_CURRENT:
+		/* Grayscale gets a frame around the cell below */
+		if (!is_grayscale) {
+			bg = colors[11];
+			fg = colors[16];
+		}
+	break;
+	}
 
 	int x = pos.col * char_width;
 	int y = pos.row * char_height;
 
-	gp_fill_rect_xywh(backend->pixmap, x, y, char_width, char_height, bg);
-
 	//fprintf(stderr, "Drawing %x %c %02i %02i\n", buf[0], buf[0], pos.row, pos.col);
 /*
 	if (c.width > 1)
 		fprintf(stderr, "%i\n", c.width);
 */
-	if (c.chars[0] >= 0x2500 && c.chars[0] <= 0x257f) {
-		draw_utf8_frames(x, y, c.chars[0], fg);
+	if (ch >= 0x2500 && ch <= 0x257f) {
+		cell_fill_rect(backend->pixmap, x, y, char_width, char_height, bg);
+		draw_utf8_frames(x, y, ch, fg);
 		return;
 	}
 
-	gp_text_style *style = c.attrs.bold ? text_style_bold : text_style;
+	const gp_text_style *style = bold ? text_style_bold : text_style;
+
+	if (ch && ch != (uint32_t)-1) {
+		cell_draw_glyph(backend->pixmap, style, x, y,
+		                char_width, char_height, fg, bg, ch);
+	} else {
+		cell_fill_rect(backend->pixmap, x, y, char_width, char_height, bg);
+	}
 
-	if (c.chars[0])
-		gp_glyph_draw(backend->pixmap, style, x, y, GP_TEXT_BEARING, fg, bg, c.chars[0]);
+	if (hint)
+		gp_hline_xyw(backend->pixmap, x, y + char_height - 1, char_width, fg);
 
-	if (is_cursor && !focused)
+	if ((is_cursor && !focused) || (hl == SEARCH_HL_CURRENT && is_grayscale))
 		gp_rect_xywh(backend->pixmap, x, y, char_width, char_height, colors[fg_color_idx]);
 }
 
-static void update_rect(VTermRect rect)
+static void paint_grid_cell(VTermPos pos, const struct grid_cell *c,
+                            int is_cursor, enum search_hl hl, uint8_t hint)
+{
+	gp_pixel bg = colors[c->bg];
+	gp_pixel fg = colors[c->fg];
+
+	if (c->ch & GRID_IMAGE) {
+		int x = pos.col * char_width;
+		int y = pos.row * char_height;
+
+		if (sixel_draw_tile(backend->pixmap, x, y, grid_cell_ch(c)))
+			cell_fill_rect(backend->pixmap, x, y, char_width, char_height, bg);
+
+		if (is_cursor)
+			gp_rect_xywh(backend->pixmap, x, y, char_width, char_height, colors[fg_color_idx]);
+
+		return;
+	}
+
+	if (c->ch & GRID_REVERSE)
+		GP_SWAP(bg, fg);
+
+	paint_cell(pos, grid_cell_ch(c), c->ch & GRID_BOLD, fg, bg, is_cursor, hl, hint);
+}
+
+/*
+ * Draws the screen cell at pos into the dst cell.
+ */
+static void draw_cell_at(VTermPos pos, VTermPos dst, int is_cursor, enum search_hl hl)
+{
+	uint8_t hint = hints_cell(pos.row, pos.col);
+	VTermScreenCell c;
+	gp_pixel bg, fg;
+
+	if (grid_mode) {
+		paint_grid_cell(dst, grid_cell(pos.row, pos.col), is_cursor, hl, hint);
+		return;
+	}
+
+	vterm_screen_get_cell(vts, pos, &c);
+
+#ifdef HAVE_COLOR_INDEXED
+	bg = colors[c.bg.indexed.idx];
+	fg = colors[c.fg.indexed.idx];
+#else
+	bg = colors[c.bg.red];
+	fg = colors[c.fg.red];
+#endif
+
+	if (c.attrs.reverse)
+		GP_SWAP(bg, fg);
+
+	paint_cell(dst, c.chars[0], c.attrs.bold, fg, bg, is_cursor, hl, hint);
+}
+
+static void draw_cell(VTermPos pos, int is_cursor)
+{
+	draw_cell_at(pos, pos, is_cursor, search_cell_hl(pos.row, pos.col));
+}
+
+/* What caused a flush, shown by the damage visualization */
+enum flush_cause {
+	FLUSH_TEXT,
+	FLUSH_CURSOR,
+	FLUSH_RESIZE,
+	FLUSH_FULL,
+	FLUSH_OVERLAY,
+	FLUSH_CAUSES,
+};
+
+static int dbg_damage;
+
+static void dbg_record(gp_coord x, gp_coord y, gp_size w, gp_size h,
+                       enum flush_cause cause);
+
+/*
+ * Flushes rectangle to the screen and to the exported framebuffer.
+ */
+static void backend_update(gp_coord x, gp_coord y, gp_size w, gp_size h,
+                           enum flush_cause cause)
+{
+	if (dbg_damage)
+		dbg_record(x, y, w, h, cause);
+
+	if (shm_export)
+		shm_export_rect(backend->pixmap, x, y, w, h);
+
+	gp_backend_update_rect_xywh(backend, x, y, w, h);
+	stats_latency_flush();
+}
+
+static void update_rect(VTermRect rect, enum flush_cause cause)
 {
 	int x = rect.start_col * char_width;
 	int y = rect.start_row * char_height;
 	int w = rect.end_col * char_width - 1;
 	int h = rect.end_row * char_height - 1;
+	int full = rect.start_col == 0 && rect.start_row == 0 &&
+	           rect.end_col == (int)cols && rect.end_row == (int)rows;
+
+	stats.flushes++;
+	stats.update_area += (uint64_t)(w - x + 1) * (h - y + 1);
+
+	/* Presented frame with shell output */
+	if (startup_pending && startup_us[STARTUP_FIRST_BYTE])
+		startup_mark(STARTUP_FIRST_FRAME);
+
+	if (dbg_damage)
+		dbg_record(x, y, w - x + 1, h - y + 1, full && cause == FLUSH_TEXT ? FLUSH_FULL : cause);
+
+	if (full) {
+		if (shm_export)
+			shm_export_rect(backend->pixmap, 0, 0, w + 1, h + 1);
 
-	if (rect.start_col == 0 && rect.start_row == 0 &&
-	    rect.end_col == cols && rect.end_row == rows) {
 		gp_backend_flip(backend);
 	} else {
+		if (shm_export)
+			shm_export_rect(backend->pixmap, x, y, w - x + 1, h - y + 1);
+
 		gp_backend_update_rect_xyxy(backend, x, y, w, h);
 	}
+
+	stats_latency_flush();
 }
 
 static VTermRect damaged;
 static int damage_repainted = 1;
+/* Cause of the pending damage, reset once it's presented */
+static enum flush_cause damage_cause;
 
 static int cursor_col;
 static int cursor_row;
 static int cursor_visible;
 static int cursor_disable;
 
+/*
+ * Window is not visible, drawing is suspended and the damage accumulates until
+ * it's shown again. The shared memory mirror is kept up to date regardless.
+ */
+static int hidden;
+static int hidden_cursor_col;
+static int hidden_cursor_row;
+static int hidden_cursor_visible;
+
+/* The scrollback viewport is scrolled back and frozen */
+static int view_scrolled;
+
+static int render_suspended(void)
+{
+	return (hidden && !shm_export) || view_scrolled;
+}
+
 static void repaint_cursor(void)
 {
 	unsigned int x = cursor_col * char_width;
@@ -174,7 +434,86 @@ static void repaint_cursor(void)
 
 //	fprintf(stderr, "Painting cursor %ux%u\n", cursor_col, cursor_row);
 
-	gp_backend_update_rect_xywh(backend, x, y, char_width, char_height);
+	stats.flushes++;
+	stats.cursor_redraws++;
+	stats.update_area += char_width * char_height;
+	backend_update(x, y, char_width, char_height, FLUSH_CURSOR);
+}
+
+static int search_mode;
+static int search_regex;
+static char search_query[256];
+static int search_query_invalid;
+
+/*
+ * Draws search prompt over the last row.
+ */
+static void draw_search_bar(void)
+{
+	struct search_status st;
+	gp_pixel fg = colors[bg_color_idx];
+	gp_pixel bg = colors[fg_color_idx];
+	unsigned int y = (rows - 1) * char_height;
+	char status[128];
+
+	search_status(&st);
+
+	if (search_query_invalid) {
+		snprintf(status, sizeof(status), "invalid regex");
+	} else if (st.current_line >= 0) {
+		snprintf(status, sizeof(status), "%lu/%lu%s history line %lli",
+		         st.current, st.history_matches + st.screen_matches,
+		         st.truncated ? "+" : "", st.current_line);
+	} else {
+		snprintf(status, sizeof(status), "%lu/%lu%s",
+		         st.current, st.history_matches + st.screen_matches,
+		         st.truncated ? "+" : "");
+	}
+
+	gp_fill_rect_xywh(backend->pixmap, 0, y, cols * char_width, char_height, bg);
+	gp_print(backend->pixmap, text_style, 0, y, GP_ALIGN_RIGHT | GP_VALIGN_BELOW,
+	         fg, bg, "%s: %s_", search_regex ? "Regex" : "Search", search_query);
+	gp_text(backend->pixmap, text_style, cols * char_width - 1, y,
+	        GP_ALIGN_LEFT | GP_VALIGN_BELOW, fg, bg, status);
+}
+
+#define HUD_COLS 24
+#define HUD_ROWS 7
+#define HUD_INTERVAL 1000
+
+static int hud_enabled;
+static char hud_lines[HUD_ROWS][HUD_COLS];
+
+static int hud_visible(void)
+{
+	return hud_enabled && cols >= HUD_COLS && rows >= HUD_ROWS;
+}
+
+static VTermRect hud_rect(void)
+{
+	VTermRect rect = {.start_row = 0, .end_row = HUD_ROWS,
+	                  .start_col = cols - HUD_COLS, .end_col = cols};
+
+	return rect;
+}
+
+/*
+ * Draws performance overlay into the top right corner.
+ */
+static void draw_hud(void)
+{
+	gp_pixel fg = colors[bg_color_idx];
+	gp_pixel bg = colors[fg_color_idx];
+	unsigned int x = (cols - HUD_COLS) * char_width;
+	int i;
+
+	gp_fill_rect_xywh(backend->pixmap, x, 0, HUD_COLS * char_width,
+	                  HUD_ROWS * char_height, bg);
+
+	for (i = 0; i < HUD_ROWS; i++) {
+		gp_text(backend->pixmap, text_style, x + char_width, i * char_height,
+		        GP_ALIGN_RIGHT | GP_VALIGN_BELOW, fg, bg, hud_lines[i]);
+	}
 }
 
 static void merge_damage(VTermRect rect)
@@ -192,277 +531,1729 @@ static void merge_damage(VTermRect rect)
 	damaged.end_row = GP_MAX(damaged.end_row, rect.end_row);
 }
 
-static void repaint_damage(void)
+static int rects_overlap(VTermRect a, VTermRect b)
 {
-	int row, col;
+	return a.start_row < b.end_row && b.start_row < a.end_row &&
+	       a.start_col < b.end_col && b.start_col < a.end_col;
+}
 
-	for (row = damaged.start_row; row < damaged.end_row; row++) {
-		for (col = damaged.start_col; col < damaged.end_col; col++) {
-			VTermPos pos = {.row = row, .col = col};
-			draw_cell(pos, 0);
-		}
-	}
+static int in_rect(VTermRect rect, int col, int row)
+{
+	return row >= rect.start_row && row < rect.end_row &&
+	       col >= rect.start_col && col < rect.end_col;
+}
 
-	if (cursor_row >= damaged.start_row && cursor_row < damaged.end_row &&
-	    cursor_col >= damaged.start_col && cursor_col < damaged.end_col &&
-	    cursor_visible)
-		repaint_cursor();
+static int in_damage(int col, int row)
+{
+	if (damage_repainted)
+		return 0;
 
-	update_rect(damaged);
-	damage_repainted = 1;
+	return in_rect(damaged, col, row);
 }
 
-
-static int term_damage(VTermRect rect, void *user_data)
+static VTermRect cell_rect(int col, int row)
 {
-	(void)user_data;
-
-	merge_damage(rect);
-//	fprintf(stderr, "rect: %i %i %i %i\n", rect.start_row, rect.end_row, rect.start_col, rect.end_col);
+	VTermRect rect = {.start_row = row, .end_row = row + 1,
+	                  .start_col = col, .end_col = col + 1};
 
-	return 1;
+	return rect;
 }
 
-static int term_moverect(VTermRect dest, VTermRect src, void *user_data)
+/*
+ * Draws the cursor and the overlays over the repainted cells and flushes the
+ * rectangle.
+ */
+static void present_damage(VTermRect rect)
 {
-	(void)dest;
-	(void)src;
-	(void)user_data;
-	fprintf(stderr, "Move rect!\n");
+	stats.frames++;
+	stats.cells += (rect.end_row - rect.start_row) *
+	               (rect.end_col - rect.start_col);
 
-	return 0;
+	STATS_TRACE("frame rows %i-%i cols %i-%i\n", rect.start_row, rect.end_row,
+	            rect.start_col, rect.end_col);
+
+	/* Cursor cell is flushed together with the damage */
+	if (cursor_visible && in_rect(rect, cursor_col, cursor_row)) {
+		VTermPos pos = {.col = cursor_col, .row = cursor_row};
+		draw_cell(pos, 1);
+	}
+
+	if (search_mode && rect.end_row == (int)rows) {
+		draw_search_bar();
+		rect.start_col = 0;
+		rect.end_col = cols;
+	}
+
+	/*
+	 * The overlay is redrawn over the damage and flushed on its own so that
+	 * it does not change the update area it displays.
+	 */
+	if (hud_visible() && rects_overlap(rect, hud_rect())) {
+		draw_hud();
+		update_rect(rect, damage_cause);
+		backend_update((cols - HUD_COLS) * char_width, 0,
+		               HUD_COLS * char_width, HUD_ROWS * char_height, FLUSH_OVERLAY);
+	} else {
+		update_rect(rect, damage_cause);
+	}
+
+	damage_cause = FLUSH_TEXT;
 }
 
-static void clear_cursor(void)
+/*
+ * Render pipeline, in grid mode the damaged cells are rasterized by a render
+ * thread from a snapshot of the grid rows while the main thread parses the
+ * next chunk of the PTY data. The snapshot rows are copied only when they are
+ * written to before the frame is finished.
+ *
+ * There is at most one frame in flight, the damage accumulates meanwhile and
+ * is submitted once the render thread signals completion over an eventfd. The
+ * cursor and the overlays are drawn and the frame is flushed from the main
+ * thread after the render thread has finished, so that the backend is never
+ * touched from two threads. The main thread does not draw anything while a
+ * frame is in flight, which is what keeps the unlocked glyph cache in
+ * cell_kernels.c consistent, there is always a single thread drawing.
+ */
+static int pipeline;
+static int render_efd = -1;
+static int render_busy;
+
+static pthread_t render_thread;
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+static const struct grid_cell *const *render_rows;
+static VTermRect render_rect;
+static int render_pending;
+
+static void *render_main(void *arg)
 {
-	unsigned int x = cursor_col * char_width;
-	unsigned int y = cursor_row * char_height;
+	uint64_t done = 1;
 
-	VTermPos pos = {.col = cursor_col, .row = cursor_row};
+	(void)arg;
 
-	draw_cell(pos, 0);
+	for (;;) {
+		int row, col;
 
-//	fprintf(stderr, "Clearing cursor %ux%u\n", cursor_col, cursor_row);
+		pthread_mutex_lock(&render_lock);
+
+		while (!render_pending)
+			pthread_cond_wait(&render_cond, &render_lock);
 
-	gp_backend_update_rect_xywh(backend, x, y, char_width, char_height);
+		render_pending = 0;
+
+		pthread_mutex_unlock(&render_lock);
+
+		for (row = render_rect.start_row; row < render_rect.end_row; row++) {
+			for (col = render_rect.start_col; col < render_rect.end_col; col++) {
+				VTermPos pos = {.row = row, .col = col};
+
+				paint_grid_cell(pos, &render_rows[row][col], 0, SEARCH_HL_NONE,
+				                hints_cell(row, col));
+			}
+		}
+
+		if (write(render_efd, &done, sizeof(done)) != sizeof(done))
+			fprintf(stderr, "Render thread: write(): %s\n", strerror(errno));
+	}
+
+	return NULL;
 }
 
-static int term_movecursor(VTermPos pos, VTermPos oldpos, int visible, void *user_data)
+static void render_submit(void)
 {
-	(void)user_data;
+	render_rect = damaged;
+	render_rows = grid_snapshot(damaged.start_row, damaged.end_row);
+	render_busy = 1;
+	damage_repainted = 1;
 
-	if (!cursor_visible || cursor_disable) {
-		cursor_col = pos.col;
-		cursor_row = pos.row;
-		return 1;
+	pthread_mutex_lock(&render_lock);
+	render_pending = 1;
+	pthread_cond_signal(&render_cond);
+	pthread_mutex_unlock(&render_lock);
+}
+
+static void render_complete(void)
+{
+	uint64_t done;
+	ssize_t ret;
+
+	/* render_sync() callers rely on the frame being finished on return */
+	while ((ret = read(render_efd, &done, sizeof(done))) < 0 && errno == EINTR);
+
+	if (ret != sizeof(done)) {
+		fprintf(stderr, "Render eventfd read(): %s\n", strerror(errno));
+		return;
 	}
 
-	clear_cursor();
+	grid_snapshot_release();
+	render_busy = 0;
 
-	cursor_col = pos.col;
-	cursor_row = pos.row;
+	present_damage(render_rect);
+}
 
-	repaint_cursor();
+/*
+ * Waits for the frame in flight, has to be called before the main thread
+ * draws or resizes the grid.
+ */
+static void render_sync(void)
+{
+	if (render_busy)
+		render_complete();
+}
 
-	fprintf(stderr, "Move cursor %i %i -> %i %i!\n", oldpos.col, oldpos.row, pos.col, pos.row);
+static void repaint_damage(void);
 
-	//vterm_screen_flush_damage(vts);
+static enum gp_poll_event_ret render_event(gp_fd *self)
+{
+	(void)self;
 
-	return 1;
+	stats.render_wakeups++;
+
+	render_complete();
+	repaint_damage();
+
+	return 0;
 }
 
-static void term_cursor_visible(int visible)
+static int render_init(void)
 {
-	if (visible == cursor_visible)
-		return;
+	if (grid_snapshot_init())
+		return -1;
 
-	if (visible)
-		repaint_cursor();
-	else
-		clear_cursor();
+	render_efd = eventfd(0, EFD_CLOEXEC);
+	if (render_efd < 0)
+		return -1;
 
-	cursor_visible = visible;
+	if (pthread_create(&render_thread, NULL, render_main, NULL)) {
+		close(render_efd);
+		render_efd = -1;
+		return -1;
+	}
+
+	return 0;
 }
 
-static int term_settermprop(VTermProp prop, VTermValue *val, void *user_data)
+/*
+ * Damage visualization, flushed rectangles are outlined and their cells
+ * tinted with a color by the flush cause. The overlays fade out in a few
+ * timer steps and the cells under them are redrawn once they are gone.
+ * Nothing is recorded or drawn unless enabled.
+ */
+#define DBG_RECTS 64
+#define DBG_STEPS 4
+#define DBG_STEP_MS 100
+
+struct dbg_rect {
+	VTermRect cells;
+	gp_coord x, y;
+	gp_size w, h;
+	uint8_t cause;
+	uint8_t step;
+};
+
+static struct dbg_rect dbg_rects[DBG_RECTS];
+static unsigned int dbg_cnt;
+
+static const uint8_t dbg_rgb[FLUSH_CAUSES][3] = {
+	[FLUSH_TEXT] = {0x00, 0xff, 0x00},
+	[FLUSH_CURSOR] = {0xff, 0x00, 0x00},
+	[FLUSH_RESIZE] = {0x00, 0x80, 0xff},
+	[FLUSH_FULL] = {0xff, 0x00, 0xff},
+	[FLUSH_OVERLAY] = {0xff, 0xff, 0x00},
+};
+
+static void dbg_mix(gp_coord x, gp_coord y, gp_pixel color, uint8_t perc)
 {
-	(void)user_data;
+	gp_pixmap *p = backend->pixmap;
 
-	switch (prop) {
-	case VTERM_PROP_TITLE:
-	//	fprintf(stderr, "caption %s\n", val->string.str);
-	//	gp_backend_set_caption(backend, val->string.str);
-		return 1;
-	case VTERM_PROP_ALTSCREEN:
-		fprintf(stderr, "altscreen %i\n", val->boolean);
-		return 0;
-	case VTERM_PROP_ICONNAME:
-	//	fprintf(stderr, "iconname %s\n", val->string.str);
-		return 0;
-	case VTERM_PROP_CURSORSHAPE:
-		fprintf(stderr, "cursorshape %i\n", val->number);
-		//TODO: HACK!
-		term_cursor_visible(1);
-		return 0;
-	case VTERM_PROP_REVERSE:
-		fprintf(stderr, "reverse %i\n", val->boolean);
-		return 0;
-	case VTERM_PROP_CURSORVISIBLE:
-		fprintf(stderr, "cursorvisible %i\n", val->boolean);
-		term_cursor_visible(val->boolean);
-		return 0;
-	case VTERM_PROP_CURSORBLINK:
-		fprintf(stderr, "blink %i\n", val->boolean);
-		return 0;
-	case VTERM_PROP_MOUSE:
-		fprintf(stderr, "mouse %i\n", val->number);
-		return 0;
-#ifdef VTERM_PROP_FOCUSREPORT
-	case VTERM_PROP_FOCUSREPORT:
-		fprintf(stderr, "focus report %i\n", val->boolean);
+	gp_putpixel(p, x, y, gp_mix_pixels(color, gp_getpixel(p, x, y), perc, p->pixel_type));
+}
+
+static void dbg_draw(const struct dbg_rect *r)
+{
+	const uint8_t *rgb = dbg_rgb[r->cause];
+	gp_pixel color = gp_rgb_to_pixmap_pixel(rgb[0], rgb[1], rgb[2], backend->pixmap);
+	uint8_t tint = (DBG_STEPS - r->step) * 16;
+	uint8_t outline = (DBG_STEPS - r->step) * 255 / DBG_STEPS;
+	gp_coord x, y, x1 = r->x + r->w - 1, y1 = r->y + r->h - 1;
+
+	for (y = r->y; y <= y1; y++) {
+		for (x = r->x; x <= x1; x++) {
+			int edge = x == r->x || x == x1 || y == r->y || y == y1;
+
+			dbg_mix(x, y, color, edge ? outline : tint);
+		}
+	}
+}
+
+static void dbg_flush(const struct dbg_rect *r)
+{
+	if (shm_export)
+		shm_export_rect(backend->pixmap, r->x, r->y, r->w, r->h);
+
+	gp_backend_update_rect_xywh(backend, r->x, r->y, r->w, r->h);
+}
+
+/*
+ * Redraws the cells under the overlay.
+ */
+static void dbg_restore(const struct dbg_rect *r)
+{
+	VTermPos pos;
+
+	for (pos.row = r->cells.start_row; pos.row < r->cells.end_row; pos.row++) {
+		for (pos.col = r->cells.start_col; pos.col < r->cells.end_col; pos.col++) {
+			draw_cell(pos, cursor_visible && pos.row == cursor_row &&
+			               pos.col == cursor_col);
+		}
+	}
+}
+
+static void dbg_overlays_redraw(void)
+{
+	if (search_mode)
+		draw_search_bar();
+
+	if (hud_visible())
+		draw_hud();
+}
+
+static uint32_t dbg_step(gp_timer *self)
+{
+	unsigned int i, cnt = 0;
+
+	(void)self;
+
+	stats.timer_wakeups++;
+
+	if (!dbg_cnt)
+		return GP_TIMER_STOP;
+
+	/* The main thread does not draw while a frame is in flight */
+	if (render_busy || render_suspended())
+		return DBG_STEP_MS;
+
+	for (i = 0; i < dbg_cnt; i++)
+		dbg_restore(&dbg_rects[i]);
+
+	dbg_overlays_redraw();
+
+	for (i = 0; i < dbg_cnt; i++) {
+		struct dbg_rect *r = &dbg_rects[i];
+
+		if (++r->step < DBG_STEPS) {
+			dbg_draw(r);
+			dbg_rects[cnt++] = *r;
+		}
+
+		dbg_flush(r);
+	}
+
+	dbg_cnt = cnt;
+
+	return dbg_cnt ? DBG_STEP_MS : GP_TIMER_STOP;
+}
+
+static gp_timer dbg_timer = {
+	.callback = dbg_step,
+	.id = "Damage debug",
+};
+
+static void dbg_record(gp_coord x, gp_coord y, gp_size w, gp_size h,
+                       enum flush_cause cause)
+{
+	struct dbg_rect *r;
+
+	/* The oldest overlay is dropped early */
+	if (dbg_cnt == DBG_RECTS) {
+		dbg_restore(&dbg_rects[0]);
+		dbg_flush(&dbg_rects[0]);
+		memmove(dbg_rects, dbg_rects + 1, --dbg_cnt * sizeof(*dbg_rects));
+	}
+
+	r = &dbg_rects[dbg_cnt++];
+
+	r->x = x;
+	r->y = y;
+	r->w = w;
+	r->h = h;
+	r->cause = cause;
+	r->step = 0;
+	r->cells.start_col = x / char_width;
+	r->cells.start_row = y / char_height;
+	r->cells.end_col = GP_MIN((int)cols, (int)((x + w + char_width - 1) / char_width));
+	r->cells.end_row = GP_MIN((int)rows, (int)((y + h + char_height - 1) / char_height));
+
+	dbg_draw(r);
+
+	if (!gp_timer_is_running(&dbg_timer)) {
+		dbg_timer.expires = DBG_STEP_MS;
+		gp_backend_timer_start(backend, &dbg_timer);
+	}
+}
+
+static void dbg_toggle(void)
+{
+	dbg_damage = !dbg_damage;
+
+	if (dbg_damage)
+		return;
+
+	if (gp_timer_is_running(&dbg_timer))
+		gp_backend_timer_stop(backend, &dbg_timer);
+
+	if (!dbg_cnt)
+		return;
+
+	dbg_cnt = 0;
+	merge_damage((VTermRect){.start_row = 0, .end_row = rows,
+	                         .start_col = 0, .end_col = cols});
+	repaint_damage();
+}
+
+/*
+ * Rescans the rows damaged since the last frame and damages rows where the
+ * hints have changed, the render thread has to be idle.
+ */
+static void hints_damage_rows(void)
+{
+	unsigned int row;
+
+	if (!hints_map)
+		return;
+
+	hints_update();
+
+	for (row = 0; row < rows; row++) {
+		if (!hints_row_changed(row))
+			continue;
+
+		VTermRect rect = {.start_row = row, .end_row = row + 1,
+		                  .start_col = 0, .end_col = cols};
+
+		merge_damage(rect);
+	}
+}
+
+static void repaint_damage(void)
+{
+	int row, col;
+
+	if (damage_repainted || render_suspended())
+		return;
+
+	/* Search highlight is evaluated on the main thread */
+	if (pipeline) {
+		if (!search_mode) {
+			if (!render_busy) {
+				hints_damage_rows();
+				render_submit();
+			}
+			return;
+		}
+
+		render_sync();
+	}
+
+	hints_damage_rows();
+
+	for (row = damaged.start_row; row < damaged.end_row; row++) {
+		for (col = damaged.start_col; col < damaged.end_col; col++) {
+			VTermPos pos = {.row = row, .col = col};
+			draw_cell(pos, 0);
+		}
+	}
+
+	present_damage(damaged);
+	damage_repainted = 1;
+}
+
+static void hud_sample(void)
+{
+	static unsigned long prev_hits, prev_misses;
+	unsigned long hits, misses;
+	struct stats_rates r;
+
+	/* Counters were reset over the control socket */
+	if (cell_kernels_stats.glyph_hits < prev_hits ||
+	    cell_kernels_stats.glyph_misses < prev_misses)
+		prev_hits = prev_misses = 0;
+
+	hits = cell_kernels_stats.glyph_hits - prev_hits;
+	misses = cell_kernels_stats.glyph_misses - prev_misses;
+
+	stats_rates(&r);
+
+	prev_hits = cell_kernels_stats.glyph_hits;
+	prev_misses = cell_kernels_stats.glyph_misses;
+
+	snprintf(hud_lines[0], HUD_COLS, "FPS   %8.1f", r.fps);
+	snprintf(hud_lines[1], HUD_COLS, "PTY   %8.1f KiB/s", r.pty_bytes_per_s / 1024);
+	snprintf(hud_lines[2], HUD_COLS, "Cells %8.0f /frame", r.cells_per_frame);
+	snprintf(hud_lines[3], HUD_COLS, "Area  %8.0f px/fr", r.area_per_frame);
+	snprintf(hud_lines[4], HUD_COLS, "Read  %8.1f us", r.read_us);
+	snprintf(hud_lines[5], HUD_COLS, "Glyph %8.1f %% hit",
+	         hits + misses ? 100.0 * hits / (hits + misses) : 100.0);
+	snprintf(hud_lines[6], HUD_COLS, "Wake  %8.1f /s", r.wakeups_per_s);
+}
+
+/*
+ * Redraws the overlay with fresh numbers. The overlay flushes are not
+ * accounted so that the measurements do not depend on it being shown.
+ */
+static uint32_t hud_update(gp_timer *self)
+{
+	(void)self;
+
+	stats.hud_wakeups++;
+
+	if (!hud_enabled)
+		return GP_TIMER_STOP;
+
+	hud_sample();
+
+	if (hud_visible() && !render_suspended() && !render_busy) {
+		draw_hud();
+		backend_update((cols - HUD_COLS) * char_width, 0,
+		               HUD_COLS * char_width, HUD_ROWS * char_height, FLUSH_OVERLAY);
+	}
+
+	return HUD_INTERVAL;
+}
+
+static gp_timer hud_timer = {
+	.callback = hud_update,
+	.id = "HUD",
+};
+
+static void hud_toggle(void)
+{
+	hud_enabled = !hud_enabled;
+
+	if (!hud_enabled) {
+		if (gp_timer_is_running(&hud_timer))
+			gp_backend_timer_stop(backend, &hud_timer);
+
+		if (cols >= HUD_COLS && rows >= HUD_ROWS) {
+			merge_damage(hud_rect());
+			repaint_damage();
+		}
+
+		return;
+	}
+
+	hud_timer.expires = 0;
+	gp_backend_timer_start(backend, &hud_timer);
+}
+
+
+/*
+ * Damages rows where search highlight has changed.
+ */
+static void search_damage_rows(void)
+{
+	unsigned int row;
+
+	for (row = 0; row < rows; row++) {
+		if (!search_row_hl_changed(row))
+			continue;
+
+		VTermRect rect = {.start_row = row, .end_row = row + 1,
+		                  .start_col = 0, .end_col = cols};
+
+		merge_damage(rect);
+	}
+}
+
+static void search_redraw(void)
+{
+	VTermRect bar = {.start_row = rows - 1, .end_row = rows,
+	                 .start_col = 0, .end_col = cols};
+
+	search_damage_rows();
+	merge_damage(bar);
+	repaint_damage();
+}
+
+static void search_query_changed(void)
+{
+	search_query_invalid = !!search_set_query(search_query, search_regex);
+	search_redraw();
+}
+
+static void search_enter(void)
+{
+	search_mode = 1;
+	search_query[0] = 0;
+	search_query_changed();
+}
+
+static void search_exit(void)
+{
+	search_mode = 0;
+	search_query_invalid = 0;
+	search_clear();
+	search_redraw();
+}
+
+static void search_key(gp_event *ev)
+{
+	size_t len = strlen(search_query);
+
+	switch (ev->val) {
+	case GP_KEY_ESC:
+		search_exit();
 	break;
-#endif
-	default:
-		fprintf(stderr, "PROP %i\n", prop);
+	case GP_KEY_BACKSPACE:
+		if (!len)
+			break;
+		/* Remove whole UTF-8 sequence */
+		while (len && (search_query[len-1] & 0xc0) == 0x80)
+			len--;
+		search_query[len ? len - 1 : 0] = 0;
+		search_query_changed();
+	break;
+	case GP_KEY_ENTER:
+	case GP_KEY_UP:
+		search_next(-1);
+		search_redraw();
 	break;
+	case GP_KEY_DOWN:
+		search_next(1);
+		search_redraw();
+	break;
+	case GP_KEY_R:
+		if (!gp_ev_any_key_pressed(ev, GP_KEY_LEFT_CTRL, GP_KEY_RIGHT_CTRL))
+			break;
+		search_regex = !search_regex;
+		search_query_changed();
+	break;
+	}
+}
+
+static void search_utf(gp_event *ev)
+{
+	size_t len = strlen(search_query);
+	char buf[4];
+	int bytes;
+
+	if (ev->utf.ch < 0x20 || ev->utf.ch == 0x7f)
+		return;
+
+	if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_CTRL, GP_KEY_RIGHT_CTRL))
+		return;
+
+	bytes = gp_to_utf8(ev->utf.ch, buf);
+	if (len + bytes >= sizeof(search_query))
+		return;
+
+	memcpy(search_query + len, buf, bytes);
+	search_query[len + bytes] = 0;
+	search_query_changed();
+}
+
+static void view_damage(void);
+
+static int term_damage(VTermRect rect, void *user_data)
+{
+	(void)user_data;
+
+	if (render_suspended()) {
+		stats.hidden_cells += (rect.end_row - rect.start_row) *
+		                      (rect.end_col - rect.start_col);
+		view_damage();
+	}
+
+	merge_damage(rect);
+	search_screen_damage(rect.start_row, rect.end_row);
+	hints_damage(rect.start_row, rect.end_row);
+//	fprintf(stderr, "rect: %i %i %i %i\n", rect.start_row, rect.end_row, rect.start_col, rect.end_col);
+
+	return 1;
+}
+
+static int term_moverect(VTermRect dest, VTermRect src, void *user_data)
+{
+	(void)dest;
+	(void)src;
+	(void)user_data;
+	fprintf(stderr, "Move rect!\n");
+
+	return 0;
+}
+
+static void clear_cursor(void)
+{
+	unsigned int x = cursor_col * char_width;
+	unsigned int y = cursor_row * char_height;
+
+	VTermPos pos = {.col = cursor_col, .row = cursor_row};
+
+	draw_cell(pos, 0);
+
+//	fprintf(stderr, "Clearing cursor %ux%u\n", cursor_col, cursor_row);
+
+	stats.flushes++;
+	stats.cursor_redraws++;
+	stats.update_area += char_width * char_height;
+	backend_update(x, y, char_width, char_height, FLUSH_CURSOR);
+}
+
+static int term_movecursor(VTermPos pos, VTermPos oldpos, int visible, void *user_data)
+{
+	(void)user_data;
+
+	if (!cursor_visible || cursor_disable) {
+		cursor_col = pos.col;
+		cursor_row = pos.row;
+		return 1;
+	}
+
+	clear_cursor();
+
+	cursor_col = pos.col;
+	cursor_row = pos.row;
+
+	repaint_cursor();
+
+	fprintf(stderr, "Move cursor %i %i -> %i %i!\n", oldpos.col, oldpos.row, pos.col, pos.row);
+
+	//vterm_screen_flush_damage(vts);
+
+	return 1;
+}
+
+static void term_cursor_visible(int visible)
+{
+	if (visible == cursor_visible)
+		return;
+
+	if (cursor_disable) {
+		cursor_visible = visible;
+		return;
+	}
+
+	if (visible)
+		repaint_cursor();
+	else
+		clear_cursor();
+
+	cursor_visible = visible;
+}
+
+/*
+ * Mouse tracking mode, the report encoding is handled by libvterm.
+ */
+static int mouse_mode = VTERM_PROP_MOUSE_NONE;
+static int altscreen_active;
+
+static void mouse_motion_stop(void);
+
+static void term_mouse_mode(int mode)
+{
+	mouse_mode = mode;
+
+	if (mode != VTERM_PROP_MOUSE_DRAG && mode != VTERM_PROP_MOUSE_MOVE)
+		mouse_motion_stop();
+}
+
+static int term_settermprop(VTermProp prop, VTermValue *val, void *user_data)
+{
+	(void)user_data;
+
+	switch (prop) {
+	case VTERM_PROP_TITLE:
+	//	fprintf(stderr, "caption %s\n", val->string.str);
+	//	gp_backend_set_caption(backend, val->string.str);
+		return 1;
+	case VTERM_PROP_ALTSCREEN:
+		fprintf(stderr, "altscreen %i\n", val->boolean);
+		altscreen_active = val->boolean;
+		return 0;
+	case VTERM_PROP_ICONNAME:
+	//	fprintf(stderr, "iconname %s\n", val->string.str);
+		return 0;
+	case VTERM_PROP_CURSORSHAPE:
+		fprintf(stderr, "cursorshape %i\n", val->number);
+		//TODO: HACK!
+		term_cursor_visible(1);
+		return 0;
+	case VTERM_PROP_REVERSE:
+		fprintf(stderr, "reverse %i\n", val->boolean);
+		return 0;
+	case VTERM_PROP_CURSORVISIBLE:
+		fprintf(stderr, "cursorvisible %i\n", val->boolean);
+		term_cursor_visible(val->boolean);
+		return 0;
+	case VTERM_PROP_CURSORBLINK:
+		fprintf(stderr, "blink %i\n", val->boolean);
+		return 0;
+	case VTERM_PROP_MOUSE:
+		fprintf(stderr, "mouse %i\n", val->number);
+		term_mouse_mode(val->number);
+		return 1;
+#ifdef VTERM_PROP_FOCUSREPORT
+	case VTERM_PROP_FOCUSREPORT:
+		fprintf(stderr, "focus report %i\n", val->boolean);
+	break;
+#endif
+	default:
+		fprintf(stderr, "PROP %i\n", prop);
+	break;
+	}
+
+	fprintf(stderr, "Set term prop!\n");
+
+	return 0;
+}
+
+static int term_screen_resize(int new_rows, int new_cols, void *user)
+{
+	(void)new_rows;
+	(void)new_cols;
+	(void)user;
+
+	fprintf(stderr, "Resize %i %i\n", new_rows, new_cols);
+
+	return 1;
+}
+
+static int term_bell(void *user)
+{
+	(void)user;
+	fprintf(stderr, "Bell!\n");
+
+	return 1;
+}
+
+/*
+ * Converts cells into UTF-8, one character per column, for search.
+ */
+static unsigned int cells_to_utf8(const VTermScreenCell *cells, int ncells,
+                                  char *buf, uint16_t *col_off)
+{
+	unsigned int len = 0;
+	int col;
+
+	for (col = 0; col < ncells; col++) {
+		uint32_t ch = cells[col].chars[0];
+
+		/* Right half of a wide character */
+		if (ch == (uint32_t)-1) {
+			if (col_off)
+				col_off[col] = col ? col_off[col-1] : 0;
+			continue;
+		}
+
+		if (col_off)
+			col_off[col] = len;
+
+		len += gp_to_utf8(ch ? ch : ' ', buf + len);
+	}
+
+	while (len && buf[len-1] == ' ')
+		len--;
+
+	return len;
+}
+
+/*
+ * With the scrollback enabled the search reads the history lines from it, the
+ * text copy is kept only without it.
+ */
+static int scrollback_text(uint64_t line, char *buf)
+{
+	struct grid_cell cells[cols];
+	uint64_t pushed = scrollback_pushed();
+
+	if (line >= pushed ||
+	    scrollback_line(pushed - 1 - line, cells, cols) < 0)
+		return -1;
+
+	return grid_cells_utf8(cells, cols, buf, NULL);
+}
+
+static void scrollback_range(uint64_t *first, uint64_t *next)
+{
+	*next = scrollback_pushed();
+	*first = *next - scrollback_lines();
+}
+
+static int grid_sb_pushline(int cols, const struct grid_cell *cells, void *user)
+{
+	(void)user;
+
+	if (scrollback_mb) {
+		scrollback_push(cells, cols);
+	} else {
+		char buf[SEARCH_BYTES_PER_COL * cols];
+
+		search_push_line(buf, grid_cells_utf8(cells, cols, buf, NULL));
+	}
+
+	return 1;
+}
+
+static const struct grid_callbacks grid_callbacks = {
+	.damage = term_damage,
+	.movecursor = term_movecursor,
+	.settermprop = term_settermprop,
+	.bell = term_bell,
+	.sb_pushline = grid_sb_pushline,
+};
+
+static unsigned int screen_row_text(int row, char *buf, uint16_t *col_off)
+{
+	VTermScreenCell c[cols];
+	unsigned int col;
+
+	for (col = 0; col < cols; col++) {
+		VTermPos pos = {.row = row, .col = col};
+
+		vterm_screen_get_cell(vts, pos, &c[col]);
+	}
+
+	return cells_to_utf8(c, cols, buf, col_off);
+}
+
+static int term_sb_pushline(int cols, const VTermScreenCell *cells, void *user)
+{
+	(void)user;
+
+	if (scrollback_mb) {
+		struct grid_cell line[cols];
+
+		grid_cells_from_screen(cells, cols, line);
+		scrollback_push(line, cols);
+	} else {
+		char buf[SEARCH_BYTES_PER_COL * cols];
+
+		search_push_line(buf, cells_to_utf8(cells, cols, buf, NULL));
+	}
+
+	return 1;
+}
+
+/*
+ * Sixel images are decoded as the DCS string arrives, the image is placed once
+ * the string has been terminated, see term_input().
+ */
+static unsigned int sixel_rows;
+
+static int term_dcs(const char *command, size_t commandlen,
+                    VTermStringFragment frag, void *user)
+{
+	(void)user;
+
+	if (!commandlen || command[commandlen - 1] != 'q')
+		return 0;
+
+	/*
+	 * The decoder writes tiles and advances the tile ring that the frame in
+	 * flight may be reading, a string spans several reads so every fragment
+	 * waits.
+	 */
+	render_sync();
+
+	if (frag.initial)
+		sixel_start(command, commandlen - 1, cols - cursor_col);
+
+	sixel_data(frag.str, frag.len);
+
+	if (frag.final)
+		sixel_rows = sixel_finish();
+
+	return 1;
+}
+
+static const VTermStateFallbacks term_fallbacks = {
+	.dcs = term_dcs,
+};
+
+/*
+ * Puts the image tiles at the cursor and moves the cursor below the image,
+ * scrolling the screen if needed.
+ */
+static void sixel_place(void)
+{
+	VTermState *vs = vterm_obtain_state(vt);
+	unsigned int row;
+
+	for (row = 0; row < sixel_rows; row++) {
+		uint32_t first_tile;
+		unsigned int tiles = sixel_row(row, &first_tile);
+		VTermPos pos;
+
+		vterm_state_get_cursorpos(vs, &pos);
+		grid_put_tiles(pos.row, pos.col, first_tile, tiles);
+		vterm_input_write(vt, "\n", 1);
+	}
+
+	sixel_rows = 0;
+}
+
+/*
+ * Printable ASCII fast path, in grid mode long runs of plain text are written
+ * into the grid directly and libvterm is only told to move the cursor over
+ * them. The last column of a row and the last character of a run are always
+ * passed to libvterm so that it handles the wrap and so that a combining
+ * character that follows is attached to the right cell.
+ */
+static int fastpath_enabled = 1;
+
+static void term_write_run(const char *buf, size_t len)
+{
+	VTermState *vs = vterm_obtain_state(vt);
+
+	while (len) {
+		char cuf[16];
+		VTermPos pos;
+		size_t n = 0, tail;
+
+		vterm_state_get_cursorpos(vs, &pos);
+
+		if (pos.col < (int)cols - 1 &&
+		    !vterm_state_get_lineinfo(vs, pos.row)->doublewidth)
+			n = GP_MIN(len - 1, cols - 1 - pos.col);
+
+		if (n < FASTPATH_RUN_MIN) {
+			vterm_input_write(vt, buf, len);
+			return;
+		}
+
+		grid_put_ascii(pos.row, pos.col, buf, n);
+		vterm_input_write(vt, cuf, snprintf(cuf, sizeof(cuf), "\e[%zuC", n));
+		stats.fast_bytes += n;
+
+		/* The last column and the character that wraps the line */
+		tail = GP_MIN(len - n, 2u);
+		vterm_input_write(vt, buf + n, tail);
+
+		buf += n + tail;
+		len -= n + tail;
+	}
+}
+
+static void term_write(const char *buf, size_t len)
+{
+	if (!fastpath_enabled || !grid_mode) {
+		vterm_input_write(vt, buf, len);
+		return;
+	}
+
+	while (len) {
+		size_t run, n = fastpath_scan(buf, len, &run);
+
+		if (n)
+			vterm_input_write(vt, buf, n);
+
+		if (run)
+			term_write_run(buf + n, run);
+
+		buf += n + run;
+		len -= n + run;
+	}
+}
+
+/*
+ * Feeds the parser, with sixel enabled the input is split after each string
+ * terminator so that the image is placed before the text that follows it is
+ * parsed, libvterm cannot be fed from its own callbacks.
+ */
+static void term_input(const char *buf, int len)
+{
+	static int last_esc;
+
+	if (!sixel_enabled) {
+		term_write(buf, len);
+		return;
+	}
+
+	while (len > 0) {
+		const char *st = memmem(buf, len, "\x1b\\", 2);
+		int n = st ? st - buf + 2 : len;
+
+		if (last_esc && buf[0] == '\\')
+			n = 1;
+
+		term_write(buf, n);
+
+		if (sixel_rows)
+			sixel_place();
+
+		last_esc = buf[n - 1] == 0x1b;
+		buf += n;
+		len -= n;
+	}
+}
+
+static VTermScreenCallbacks screen_callbacks = {
+	.damage      = term_damage,
+//	.moverect    = term_moverect,
+	.movecursor  = term_movecursor,
+	.settermprop = term_settermprop,
+	.bell        = term_bell,
+	.sb_pushline = term_sb_pushline,
+	.resize      = term_screen_resize,
+//	.sb_popline  = term_sb_popline,
+};
+
+static void *term_malloc(size_t size, void *allocdata)
+{
+	(void)allocdata;
+
+	return mem_alloc(MEM_VTERM, size);
+}
+
+static void term_free(void *ptr, void *allocdata)
+{
+	(void)allocdata;
+
+	mem_free(ptr);
+}
+
+static VTermAllocatorFunctions term_allocator = {
+	.malloc = term_malloc,
+	.free = term_free,
+};
+
+/*
+ * libvterm does not check for allocation failures, with a fixed size arena we
+ * have to make sure that the screen buffers fit before resizing. The old
+ * buffers are freed only after the new ones were allocated.
+ */
+static void term_clamp_size(void)
+{
+	size_t buffers = altscreen ? 2 : 1;
+	size_t row_cells = grid_mode ? cols + 1 : cols;
+	size_t cell_size = grid_mode ? sizeof(struct grid_cell) : VTERM_CELL_SIZE;
+
+	if (!mem_arena_enabled())
+		return;
+
+	/* Spare rows for the snapshot copy-on-write */
+	if (pipeline)
+		buffers++;
+
+	while (rows > 1 && !mem_fits(buffers * rows * row_cells * cell_size))
+		rows--;
+}
+
+static void term_init(void)
+{
+	int i;
+
+	if (rows == 0)
+		rows = 1;
+
+	if (cols == 0)
+		cols = 1;
+
+	term_clamp_size();
+
+	vt = vterm_new_with_allocator(rows, cols, &term_allocator, NULL);
+	vterm_set_utf8(vt, 1);
+	fastpath_reset();
+
+	if (grid_mode) {
+		if (grid_init(vt, altscreen, &grid_callbacks, fg_color_idx, bg_color_idx)) {
+			fprintf(stderr, "Failed to allocate grid\n");
+			exit(1);
+		}
+	} else {
+		vts = vterm_obtain_screen(vt);
+		vterm_screen_enable_altscreen(vts, altscreen);
+		vterm_screen_set_callbacks(vts, &screen_callbacks, NULL);
+	}
+
+	VTermState *vs = vterm_obtain_state(vt);
+	vterm_state_set_bold_highbright(vs, 1);
+
+	if (sixel_enabled)
+		vterm_state_set_unrecognised_fallbacks(vs, &term_fallbacks, NULL);
+
+	//vterm_screen_set_damage_merge(vts, VTERM_DAMAGE_SCROLL);
+	//vterm_screen_set_damage_merge(vts, VTERM_DAMAGE_ROW);
+
+	/* We use the vterm color as an array index */
+	for (i = 0; i < 16; i++) {
+#ifdef HAVE_COLOR_INDEXED
+		VTermColor col;
+		vterm_color_indexed(&col, i);
+#else
+		VTermColor col = {i, i, i};
+#endif
+		vterm_state_set_palette_color(vs, i, &col);
+	}
+
+#ifdef HAVE_COLOR_INDEXED
+	VTermColor bg, fg;
+
+	vterm_color_indexed(&bg, bg_color_idx);
+	vterm_color_indexed(&fg, fg_color_idx);
+#else
+	VTermColor bg = {bg_color_idx, bg_color_idx, bg_color_idx};
+	VTermColor fg = {fg_color_idx, fg_color_idx, fg_color_idx};
+#endif
+
+	vterm_state_set_default_colors(vs, &fg, &bg);
+
+	if (grid_mode)
+		vterm_state_reset(vs, 1);
+	else
+		vterm_screen_reset(vts, 1);
+}
+
+static pid_t console_pid;
+
+/*
+ * Forks and runs a shell, returns master fd.
+ */
+static int open_console(const char *term, const char *color, int cols, int rows)
+{
+	struct winsize size = {rows, cols, 0, 0};
+	int fd, pid, flags;
+
+	pid = forkpty(&fd, NULL, NULL, &size);
+	if (pid < 0)
+		return -1;
+
+	if (pid == 0) {
+		char *shell = getenv("SHELL");
+
+		if (!shell)
+			shell = "/bin/sh";
+
+		putenv(term);
+
+		if (color)
+			putenv(color);
+
+		execl(shell, shell, NULL);
+	}
+
+	flags = fcntl(fd, F_GETFL, 0);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+	console_pid = pid;
+
+	return fd;
+}
+
+/*
+ * Returns non-zero when the backend pixmap is known to be in color before the
+ * backend is initialized, i.e. when TERM can be decided early. Framebuffers
+ * and display drivers may be grayscale.
+ */
+static int backend_is_color(const char *backend_opts)
+{
+	static const char *const color_backends[] = {"x11", "xcb", "wayland", "sdl"};
+	unsigned int i;
+	size_t len;
+
+	/* Autodetection picks a windowing system when there is one */
+	if (!backend_opts)
+		return getenv("WAYLAND_DISPLAY") || getenv("DISPLAY");
+
+	len = strcspn(backend_opts, ":");
+
+	for (i = 0; i < GP_ARRAY_SIZE(color_backends); i++) {
+		if (len == strlen(color_backends[i]) &&
+		    !strncasecmp(backend_opts, color_backends[i], len))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void close_console(int fd)
+{
+	close(fd);
+}
+
+static void do_exit(int fd)
+{
+	render_sync();
+
+	if (io_uring)
+		pty_uring_exit();
+
+	if (shm_export)
+		shm_export_exit();
+
+	control_exit();
+	close_console(fd);
+	gp_backend_exit(backend);
+
+	if (mem_report_enabled) {
+		mem_report(stderr);
+		scrollback_report(stderr);
+	}
+
+	if (stats_enabled)
+		stats_report(stderr);
+
+	scrollback_exit();
+	vterm_free(vt);
+	exit(0);
+}
+
+/*
+ * Redraws the cursor after parsing, the cursor cells are touched only when the
+ * cursor has moved or changed visibility. Cells inside of the damaged area are
+ * redrawn and flushed along with the damage.
+ */
+static void update_cursor(int old_col, int old_row, int old_visible)
+{
+	if (old_col == cursor_col && old_row == cursor_row &&
+	    old_visible == cursor_visible)
+		return;
+
+	/* The cursor cells are repainted with the next frame */
+	if (render_busy) {
+		if (old_visible)
+			merge_damage(cell_rect(old_col, old_row));
+
+		if (cursor_visible)
+			merge_damage(cell_rect(cursor_col, cursor_row));
+
+		return;
+	}
+
+	if (old_visible && !in_damage(old_col, old_row)) {
+		int col = cursor_col, row = cursor_row;
+
+		cursor_col = old_col;
+		cursor_row = old_row;
+		clear_cursor();
+		cursor_col = col;
+		cursor_row = row;
+	}
+
+	if (cursor_visible && !in_damage(cursor_col, cursor_row))
+		repaint_cursor();
+}
+
+/*
+ * Suspends drawing when the window gets hidden, the cursor position on the
+ * screen is remembered so that it can be cleared once the window is shown.
+ */
+static void set_hidden(int val)
+{
+	int was_suspended = render_suspended();
+	unsigned long long cells = stats.cells;
+
+	hidden = val;
+
+	if (!was_suspended) {
+		hidden_cursor_col = cursor_col;
+		hidden_cursor_row = cursor_row;
+		hidden_cursor_visible = cursor_visible;
+		return;
+	}
+
+	if (render_suspended())
+		return;
+
+	if (hidden_cursor_visible) {
+		VTermRect rect = {.start_row = hidden_cursor_row,
+		                  .end_row = hidden_cursor_row + 1,
+		                  .start_col = hidden_cursor_col,
+		                  .end_col = hidden_cursor_col + 1};
+		merge_damage(rect);
+	}
+
+	if (cursor_visible) {
+		VTermRect rect = {.start_row = cursor_row, .end_row = cursor_row + 1,
+		                  .start_col = cursor_col, .end_col = cursor_col + 1};
+		merge_damage(rect);
+	}
+
+	repaint_damage();
+
+	stats.resume_cells += stats.cells - cells;
+}
+
+/*
+ * Scrollback viewport, the rows are addressed by absolute line numbers so that
+ * the view stays put while new lines are pushed into the scrollback. Lines
+ * past the scrollback are the screen rows.
+ *
+ * While scrolled back the view is frozen, the output is parsed and the damage
+ * accumulates as if the window was hidden. Scrolling moves the rows that are
+ * already drawn and draws only the revealed ones. History lines do not change
+ * so these are kept in a direct mapped cache of row strips and paging back
+ * and forth only blits them.
+ */
+#define VIEW_WHEEL_LINES 3
+
+/* Absolute line number of the top row */
+static uint64_t view_top;
+/* Rows at or below this line may have been drawn from the screen */
+static uint64_t view_screen_line;
+/* The screen has changed since it was drawn into the view */
+static int view_stale;
+
+static gp_pixmap view_cache;
+static uint64_t *view_cache_lines;
+static unsigned int view_cache_rows;
+
+static void view_cache_free(void)
+{
+	mem_free(view_cache.pixels);
+	mem_free(view_cache_lines);
+	view_cache.pixels = NULL;
+	view_cache_lines = NULL;
+	view_cache_rows = 0;
+}
+
+static void view_cache_alloc(void)
+{
+	gp_pixel_type type = backend->pixmap->pixel_type;
+	unsigned int w = cols * char_width;
+	unsigned int h = VIEW_CACHE_PAGES * rows * char_height;
+	size_t bpr = ((size_t)w * gp_pixel_size(type) + 7) / 8;
+	void *pixels;
+
+	if (view_cache_rows || !h)
+		return;
+
+	pixels = mem_alloc(MEM_RENDER, bpr * h);
+	view_cache_lines = mem_alloc(MEM_RENDER, sizeof(uint64_t) * VIEW_CACHE_PAGES * rows);
+
+	if (!pixels || !view_cache_lines) {
+		mem_free(pixels);
+		view_cache_free();
+		return;
+	}
+
+	gp_pixmap_init(&view_cache, w, h, type, pixels, 0);
+	view_cache_rows = VIEW_CACHE_PAGES * rows;
+	memset(view_cache_lines, 0xff, sizeof(uint64_t) * view_cache_rows);
+}
+
+static void view_draw_history(unsigned int row, uint64_t line, uint64_t pushed)
+{
+	struct grid_cell cells[cols];
+	unsigned int col;
+
+	if (scrollback_line(pushed - 1 - line, cells, cols) < 0) {
+		cell_fill_rect(backend->pixmap, 0, row * char_height,
+		               cols * char_width, char_height, colors[bg_color_idx]);
+		return;
+	}
+
+	for (col = 0; col < cols; col++) {
+		VTermPos pos = {.row = row, .col = col};
+
+		paint_grid_cell(pos, &cells[col], 0, SEARCH_HL_NONE, 0);
+	}
+}
+
+static void view_draw_row(unsigned int row)
+{
+	uint64_t line = view_top + row;
+	uint64_t pushed = scrollback_pushed();
+	unsigned int col, slot;
+
+	if (line >= pushed) {
+		for (col = 0; col < cols; col++) {
+			VTermPos pos = {.row = line - pushed, .col = col};
+			VTermPos dst = {.row = row, .col = col};
+
+			draw_cell_at(pos, dst, 0, SEARCH_HL_NONE);
+		}
+
+		view_screen_line = GP_MIN(view_screen_line, line);
+		stats.view_drawn++;
+		return;
+	}
+
+	if (!view_cache_rows) {
+		view_draw_history(row, line, pushed);
+		stats.view_drawn++;
+		return;
+	}
+
+	slot = line % view_cache_rows;
+
+	if (view_cache_lines[slot] == line) {
+		gp_blit_xywh(&view_cache, 0, slot * char_height, cols * char_width,
+		             char_height, backend->pixmap, 0, row * char_height);
+		stats.view_cached++;
+		return;
+	}
+
+	view_draw_history(row, line, pushed);
+	stats.view_drawn++;
+
+	gp_blit_xywh(backend->pixmap, 0, row * char_height, cols * char_width,
+	             char_height, &view_cache, 0, slot * char_height);
+	view_cache_lines[slot] = line;
+}
+
+static void view_damage(void)
+{
+	if (view_scrolled)
+		view_stale = 1;
+}
+
+/*
+ * Freezes the screen as it is, the cursor and the HUD are drawn over the cells
+ * so these are cleared first in order not to scroll along with the rows.
+ */
+static void view_enter(void)
+{
+	int row, col;
+
+	render_sync();
+
+	view_scrolled = 1;
+	view_top = scrollback_pushed();
+	view_screen_line = view_top;
+	view_stale = !damage_repainted;
+
+	if (cursor_visible) {
+		VTermPos pos = {.row = cursor_row, .col = cursor_col};
+
+		draw_cell_at(pos, pos, 0, SEARCH_HL_NONE);
 	}
 
-	fprintf(stderr, "Set term prop!\n");
+	if (hud_visible()) {
+		VTermRect rect = hud_rect();
 
-	return 0;
+		for (row = rect.start_row; row < rect.end_row; row++) {
+			for (col = rect.start_col; col < rect.end_col; col++) {
+				VTermPos pos = {.row = row, .col = col};
+
+				draw_cell_at(pos, pos, 0, SEARCH_HL_NONE);
+			}
+		}
+	}
+
+	view_cache_alloc();
 }
 
-static int term_screen_resize(int new_rows, int new_cols, void *user)
+/*
+ * Returns to the live screen and repaints it.
+ */
+static void view_leave(void)
 {
-	(void)new_rows;
-	(void)new_cols;
-	(void)user;
+	VTermRect rect = {.start_row = 0, .start_col = 0, .end_row = rows, .end_col = cols};
 
-	fprintf(stderr, "Resize %i %i\n", new_rows, new_cols);
+	if (!view_scrolled)
+		return;
 
-	return 1;
+	view_scrolled = 0;
+
+	merge_damage(rect);
+	repaint_damage();
 }
 
-static int term_bell(void *user)
+/*
+ * Drops the view and the cached strips without repainting, used when the
+ * terminal is resized and repainted anyway.
+ */
+static void view_reset(void)
 {
-	(void)user;
-	fprintf(stderr, "Bell!\n");
-
-	return 1;
+	view_scrolled = 0;
+	view_cache_free();
 }
 
-static int term_sb_pushline(int cols, const VTermScreenCell *cells, void *user)
+/*
+ * Scrolls the view, positive lines scroll back into the history.
+ */
+static void view_scroll(int lines)
 {
-	(void)cols;
-	(void)cells;
-	(void)user;
+	uint64_t pushed = scrollback_pushed();
+	uint64_t oldest = pushed - scrollback_lines();
+	uint64_t top = view_scrolled ? view_top : pushed;
+	uint64_t new_top, stale_line = UINT64_MAX;
+	unsigned int row, first = 0, last = rows;
+	int shift;
+
+	if (!scrollback_mb || search_mode || !lines)
+		return;
 
-	fprintf(stderr, "Pushline!\n");
+	if (lines > 0) {
+		new_top = top > oldest + lines ? top - lines : oldest;
+	} else {
+		new_top = top + -lines;
 
-	return 0;
+		if (new_top >= pushed) {
+			view_leave();
+			return;
+		}
+	}
+
+	if (new_top == top)
+		return;
+
+	if (!view_scrolled)
+		view_enter();
+
+	shift = (int64_t)(top - new_top);
+	view_top = new_top;
+
+	if (view_stale) {
+		stale_line = view_screen_line;
+		view_screen_line = UINT64_MAX;
+		view_stale = 0;
+	}
+
+	if ((unsigned int)abs(shift) < rows) {
+		unsigned int moved = rows - abs(shift);
+		int ret;
+
+		if (shift > 0) {
+			ret = cell_move_rows(backend->pixmap, shift * char_height,
+			                     0, moved * char_height);
+			last = shift;
+		} else {
+			ret = cell_move_rows(backend->pixmap, 0, -shift * char_height,
+			                     moved * char_height);
+			first = moved;
+		}
+
+		if (ret) {
+			first = 0;
+			last = rows;
+		} else {
+			stats.view_moved += moved;
+		}
+	}
+
+	for (row = 0; row < rows; row++) {
+		if ((row >= first && row < last) || view_top + row >= stale_line)
+			view_draw_row(row);
+	}
+
+	update_rect((VTermRect){.start_row = 0, .start_col = 0, .end_row = rows, .end_col = cols},
+	            FLUSH_FULL);
 }
 
-static VTermScreenCallbacks screen_callbacks = {
-	.damage      = term_damage,
-//	.moverect    = term_moverect,
-	.movecursor  = term_movecursor,
-	.settermprop = term_settermprop,
-	.bell        = term_bell,
-//	.sb_pushline = term_sb_pushline,
-	.resize      = term_screen_resize,
-//	.sb_popline  = term_sb_popline,
-};
+/* Reads this soon after a key press are considered to be an echo */
+#define ECHO_WINDOW_US 50000
+/* Maximal echo damage width */
+#define ECHO_MAX_CELLS 16
 
-static void term_init(void)
+static uint64_t last_key_us;
+
+/*
+ * Latency path for typing, if the damage is a short span on the cursor row it's
+ * painted along with the cursor and flushed in a single update.
+ *
+ * Returns non-zero if the damage was handled.
+ */
+static int echo_repaint(int old_col, int old_row, int old_visible)
 {
-	int i;
+	VTermRect span = {.start_row = cursor_row, .end_row = cursor_row + 1,
+	                  .start_col = cursor_col, .end_col = cursor_col + 1};
+	int col;
 
-	if (rows == 0)
-		rows = 1;
+	if (search_mode || render_busy ||
+	    stats_time_us() - last_key_us > ECHO_WINDOW_US)
+		return 0;
 
-	if (cols == 0)
-		cols = 1;
+	if (!damage_repainted) {
+		if (damaged.start_row != cursor_row || damaged.end_row != cursor_row + 1)
+			return 0;
 
-	vt = vterm_new(rows, cols);
-	vterm_set_utf8(vt, 1);
+		span.start_col = GP_MIN(span.start_col, damaged.start_col);
+		span.end_col = GP_MAX(span.end_col, damaged.end_col);
+	}
 
-	vts = vterm_obtain_screen(vt);
-	vterm_screen_enable_altscreen(vts, 1);
-	vterm_screen_set_callbacks(vts, &screen_callbacks, NULL);
-	VTermState *vs = vterm_obtain_state(vt);
-	vterm_state_set_bold_highbright(vs, 1);
+	if (old_visible) {
+		if (old_row != cursor_row)
+			return 0;
 
-	//vterm_screen_set_damage_merge(vts, VTERM_DAMAGE_SCROLL);
-	//vterm_screen_set_damage_merge(vts, VTERM_DAMAGE_ROW);
+		span.start_col = GP_MIN(span.start_col, old_col);
+		span.end_col = GP_MAX(span.end_col, old_col + 1);
+	}
 
-	/* We use the vterm color as an array index */
-	for (i = 0; i < 16; i++) {
-#ifdef HAVE_COLOR_INDEXED
-		VTermColor col;
-		vterm_color_indexed(&col, i);
-#else
-		VTermColor col = {i, i, i};
-#endif
-		vterm_state_set_palette_color(vs, i, &col);
+	if (span.end_col - span.start_col > ECHO_MAX_CELLS)
+		return 0;
+
+	if (hud_visible() && rects_overlap(span, hud_rect()))
+		return 0;
+
+	/* Typed text may start or end a hint, the whole row is repainted then */
+	if (hints_map) {
+		hints_update();
+
+		if (hints_row_changed(cursor_row)) {
+			VTermRect rect = {.start_row = cursor_row, .end_row = cursor_row + 1,
+			                  .start_col = 0, .end_col = cols};
+
+			merge_damage(rect);
+			return 0;
+		}
 	}
 
-#ifdef HAVE_COLOR_INDEXED
-	VTermColor bg, fg;
+	for (col = span.start_col; col < span.end_col; col++) {
+		VTermPos pos = {.row = cursor_row, .col = col};
+		draw_cell(pos, cursor_visible && col == cursor_col);
+	}
 
-	vterm_color_indexed(&bg, bg_color_idx);
-	vterm_color_indexed(&fg, fg_color_idx);
-#else
-	VTermColor bg = {bg_color_idx, bg_color_idx, bg_color_idx};
-	VTermColor fg = {fg_color_idx, fg_color_idx, fg_color_idx};
-#endif
+	stats.frames++;
+	stats.cells += span.end_col - span.start_col;
 
-	vterm_state_set_default_colors(vs, &fg, &bg);
+	update_rect(span, FLUSH_TEXT);
+	damage_repainted = 1;
 
-	vterm_screen_reset(vts, 1);
+	return 1;
 }
 
 /*
- * Forks and runs a shell, returns master fd.
+ * Parses data read from the PTY and repaints the damage.
  */
-static int open_console(const char *term, const char *color)
+static void console_process(const char *buf, int len)
 {
-	int fd, pid, flags;
+	int old_col = cursor_col;
+	int old_row = cursor_row;
+	int old_visible = cursor_visible;
+	uint64_t start = stats_time_us();
 
-	pid = forkpty(&fd, NULL, NULL, NULL);
-	if (pid < 0)
-		return -1;
+	cursor_disable = 1;
 
-	if (pid == 0) {
-		char *shell = getenv("SHELL");
+	if (startup_pending && len > 0)
+		startup_mark(STARTUP_FIRST_BYTE);
 
-		if (!shell)
-			shell = "/bin/sh";
+	if (len > 0) {
+		uint64_t parse_start = stats_time_us();
+		uint64_t parse_us;
 
-		putenv(term);
+		term_input(buf, len);
 
-		if (color)
-			putenv(color);
+		parse_us = stats_time_us() - parse_start;
+		stats.parse_us += parse_us;
+		stats_latency_pty();
 
-		execl(shell, shell, NULL);
+		STATS_TRACE("read %i bytes parsed in %llu us\n", len,
+		            (unsigned long long)parse_us);
 	}
 
-	flags = fcntl(fd, F_GETFL, 0);
-	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	cursor_disable = 0;
 
-	return fd;
-}
+	if (search_mode) {
+		search_update();
+		search_damage_rows();
+	}
 
-static void close_console(int fd)
-{
-	close(fd);
-}
+	if (render_suspended()) {
+		if (len > 0)
+			stats.hidden_reads++;
+	} else if (len > 0 && echo_repaint(old_col, old_row, old_visible)) {
+		stats.echo_reads++;
+	} else {
+		if (len > 0)
+			stats.bulk_reads++;
 
-static void do_exit(int fd)
-{
-	close_console(fd);
-	gp_backend_exit(backend);
-	vterm_free(vt);
-	exit(0);
+		update_cursor(old_col, old_row, old_visible);
+		repaint_damage();
+	}
+
+	stats.read_us += stats_time_us() - start;
 }
 
 static enum gp_poll_event_ret console_read(gp_fd *self)
@@ -471,14 +2262,12 @@ static enum gp_poll_event_ret console_read(gp_fd *self)
 	int len;
 	int fd = self->fd;
 
-	if (cursor_visible) {
-		clear_cursor();
-		cursor_disable = 1;
-	}
+	stats.pty_wakeups++;
+	stats.pty_syscalls++;
 
 	len = read(fd, buf, sizeof(buf));
 	if (len > 0)
-		vterm_input_write(vt, buf, len);
+		stats.pty_bytes += len;
 
 	if (len < 0 && errno == EAGAIN)
 		len = 0;
@@ -486,26 +2275,59 @@ static enum gp_poll_event_ret console_read(gp_fd *self)
 	if (len < 0)
 		do_exit(fd);
 
-	repaint_damage();
+	if (!len)
+		stats.pty_empty_reads++;
 
-	if (cursor_visible) {
-		cursor_disable = 0;
-		repaint_cursor();
-	}
+	console_process(buf, len);
+
+	return 0;
+}
+
+static void console_uring_read(int fd, const char *buf, int len)
+{
+	if (len <= 0)
+		do_exit(fd);
+
+	console_process(buf, len);
+}
+
+static enum gp_poll_event_ret console_uring_event(gp_fd *self)
+{
+	(void)self;
+
+	stats.pty_wakeups++;
+	pty_uring_complete();
 
 	return 0;
 }
 
+static void pty_write(int fd, const char *buf, size_t len)
+{
+	if (io_uring) {
+		pty_uring_write(buf, len);
+		return;
+	}
+
+	stats.pty_syscalls++;
+	write(fd, buf, len);
+}
+
 static void console_write(int fd, const char *buf, int buf_len)
 {
-	write(fd, buf, buf_len);
+	/* Typing returns the view to the live screen */
+	view_leave();
+
+	last_key_us = stats_time_us();
+	stats_latency_key();
+	pty_write(fd, buf, buf_len);
 }
 
 static void term_output_callback(const char *buf, size_t len, void *usr)
 {
 	int fd = *(int*)usr;
 
-	console_write(fd, buf, len);
+	/* Terminal replies, not a key press */
+	pty_write(fd, buf, len);
 }
 
 static void console_resize(int fd, int cols, int rows)
@@ -660,48 +2482,254 @@ static void init_colors_2bpp(gp_backend *backend, int reverse)
 	gp_pixel light_gray = gp_rgb_to_pixmap_pixel(0x80, 0x80, 0x80, backend->pixmap);
 	gp_pixel white = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, backend->pixmap);
 
-	for (i = 0; i < 8; i++)
-		colors[i] = reverse ? dark_gray : light_gray;
+	for (i = 0; i < 8; i++)
+		colors[i] = reverse ? dark_gray : light_gray;
+
+	for (i = 8; i < 16; i++)
+		colors[i] = reverse ? light_gray : dark_gray;
+
+	colors[fg_color_idx] = reverse ? white : black;
+	colors[bg_color_idx] = reverse ? black : white;
+}
+
+static int cursor_hidden;
+static uint64_t last_motion_ms;
+
+static uint64_t time_ms(void)
+{
+	return stats_time_us() / 1000;
+}
+
+static uint32_t hide_cursor(gp_timer *self)
+{
+	uint64_t idle = time_ms() - last_motion_ms;
+
+	(void)self;
+
+	stats.timer_wakeups++;
+
+	/* The pointer has moved since the timer was started, sleep for the rest */
+	if (idle < HIDE_CURSOR_TIMEOUT)
+		return HIDE_CURSOR_TIMEOUT - idle;
+
+	gp_backend_cursor_set(backend, GP_BACKEND_CURSOR_HIDE);
+
+	cursor_hidden = 1;
+
+	return GP_TIMER_STOP;
+}
+
+static gp_timer hide_cursor_timer = {
+	.callback = hide_cursor,
+	.id = "Hide Cursor",
+	.expires = HIDE_CURSOR_TIMEOUT,
+};
+
+/*
+ * Called on each pointer motion, the timer is not restarted while it's running
+ * instead it checks the time of the last motion when it expires.
+ */
+static void hide_cursor_reschedule(void)
+{
+	last_motion_ms = time_ms();
+
+	if (cursor_hidden) {
+		cursor_hidden = 0;
+		gp_backend_cursor_set(backend, GP_BACKEND_CURSOR_SHOW);
+	}
+
+	/* Pointer is hidden only in the focused window */
+	if (!focused || gp_timer_is_running(&hide_cursor_timer))
+		return;
+
+	hide_cursor_timer.expires = HIDE_CURSOR_TIMEOUT;
+
+	gp_backend_timer_start(backend, &hide_cursor_timer);
+}
+
+/* At most one motion report per frame */
+#define MOUSE_FRAME_MS 16
+
+static int mouse_col = -1, mouse_row = -1;
+static int mouse_pending;
+
+static VTermModifier mouse_mod(gp_event *ev)
+{
+	VTermModifier mod = VTERM_MOD_NONE;
+
+	if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_SHIFT, GP_KEY_RIGHT_SHIFT))
+		mod |= VTERM_MOD_SHIFT;
+
+	if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_CTRL, GP_KEY_RIGHT_CTRL))
+		mod |= VTERM_MOD_CTRL;
+
+	if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_ALT, GP_KEY_RIGHT_ALT))
+		mod |= VTERM_MOD_ALT;
+
+	return mod;
+}
+
+static VTermModifier mouse_pending_mod;
+
+static void mouse_report_move(VTermModifier mod)
+{
+	stats.mouse_reports++;
+	vterm_mouse_move(vt, mouse_row, mouse_col, mod);
+}
+
+static uint32_t mouse_motion(gp_timer *self)
+{
+	(void)self;
+
+	stats.timer_wakeups++;
+
+	if (!mouse_pending)
+		return GP_TIMER_STOP;
+
+	mouse_pending = 0;
+	mouse_report_move(mouse_pending_mod);
+
+	/* Timers run outside of the event batch that flushes the writes */
+	if (io_uring)
+		pty_uring_flush();
+
+	return MOUSE_FRAME_MS;
+}
+
+static gp_timer mouse_motion_timer = {
+	.callback = mouse_motion,
+	.id = "Mouse motion",
+};
+
+static void mouse_motion_stop(void)
+{
+	mouse_pending = 0;
+
+	if (gp_timer_is_running(&mouse_motion_timer))
+		gp_backend_timer_stop(backend, &mouse_motion_timer);
+}
+
+/*
+ * Updates the pointer cell, returns non-zero if it has changed.
+ */
+static int mouse_update_pos(gp_event *ev)
+{
+	int col = GP_MIN(ev->st->cursor_x / char_width, cols - 1);
+	int row = GP_MIN(ev->st->cursor_y / char_height, rows - 1);
+
+	if (col == mouse_col && row == mouse_row)
+		return 0;
+
+	mouse_col = col;
+	mouse_row = row;
+
+	return 1;
+}
+
+/*
+ * Motion is reported only when the pointer moves to a different cell and no
+ * more than once per frame, the last position in a frame is sent when the
+ * frame timer expires.
+ */
+static void mouse_move(gp_event *ev)
+{
+	if (mouse_mode != VTERM_PROP_MOUSE_DRAG &&
+	    mouse_mode != VTERM_PROP_MOUSE_MOVE)
+		return;
+
+	if (!mouse_update_pos(ev)) {
+		stats.mouse_coalesced++;
+		return;
+	}
+
+	if (gp_timer_is_running(&mouse_motion_timer)) {
+		if (mouse_pending)
+			stats.mouse_coalesced++;
 
-	for (i = 8; i < 16; i++)
-		colors[i] = reverse ? light_gray : dark_gray;
+		mouse_pending = 1;
+		mouse_pending_mod = mouse_mod(ev);
+		return;
+	}
 
-	colors[fg_color_idx] = reverse ? white : black;
-	colors[bg_color_idx] = reverse ? black : white;
-}
+	mouse_report_move(mouse_mod(ev));
 
-static int cursor_hidden;
+	mouse_motion_timer.expires = MOUSE_FRAME_MS;
+	gp_backend_timer_start(backend, &mouse_motion_timer);
+}
 
-static uint32_t hide_cursor(gp_timer *self)
+/*
+ * Reports button press or release, returns non-zero if the event was consumed.
+ *
+ * Shift bypasses the mouse reporting so that the clipboard works.
+ */
+static int mouse_button(gp_event *ev)
 {
-	gp_backend_cursor_set(backend, GP_BACKEND_CURSOR_HIDE);
+	int button;
 
-	cursor_hidden = 1;
+	if (mouse_mode == VTERM_PROP_MOUSE_NONE)
+		return 0;
 
-	return GP_TIMER_STOP;
-}
+	if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_SHIFT, GP_KEY_RIGHT_SHIFT))
+		return 0;
 
-static gp_timer hide_cursor_timer = {
-	.callback = hide_cursor,
-	.id = "Hide Cursor",
-	.expires = HIDE_CURSOR_TIMEOUT,
-};
+	switch (ev->val) {
+	case GP_BTN_LEFT:
+		button = 1;
+	break;
+	case GP_BTN_MIDDLE:
+		button = 2;
+	break;
+	case GP_BTN_RIGHT:
+		button = 3;
+	break;
+	default:
+		return 0;
+	}
 
-static void hide_cursor_reschedule(void)
+	/* Flush pending motion so that the button is reported at the right cell */
+	mouse_pending = 0;
+	mouse_update_pos(ev);
+	vterm_mouse_move(vt, mouse_row, mouse_col, mouse_mod(ev));
+
+	stats.mouse_reports++;
+	vterm_mouse_button(vt, button, ev->code != GP_EV_KEY_UP, mouse_mod(ev));
+
+	return 1;
+}
+
+/*
+ * Wheel is reported as buttons 4 and 5.
+ */
+static int mouse_wheel(gp_event *ev)
 {
-	if (gp_timer_is_running(&hide_cursor_timer))
-		gp_backend_timer_stop(backend, &hide_cursor_timer);
+	int button = ev->val > 0 ? 4 : 5;
 
-	if (cursor_hidden) {
-		cursor_hidden = 0;
-		gp_backend_cursor_set(backend, GP_BACKEND_CURSOR_SHOW);
+	if (!ev->val)
+		return 0;
+
+	/* Wheel scrolls the history unless the application asked for it */
+	if (mouse_mode == VTERM_PROP_MOUSE_NONE) {
+		if (altscreen_active)
+			return 0;
+
+		view_scroll(ev->val * VIEW_WHEEL_LINES);
+		return 1;
 	}
 
-	hide_cursor_timer.expires = HIDE_CURSOR_TIMEOUT;
+	mouse_update_pos(ev);
+	vterm_mouse_move(vt, mouse_row, mouse_col, mouse_mod(ev));
 
-	gp_backend_timer_start(backend, &hide_cursor_timer);
+	stats.mouse_reports++;
+	vterm_mouse_button(vt, button, 1, mouse_mod(ev));
+	vterm_mouse_button(vt, button, 0, mouse_mod(ev));
+
+	return 1;
 }
 
+/*
+ * The clipboard buffer is allocated by gfxprim, this is the only allocation
+ * left on the input path and happens once per paste.
+ */
 static void clipboard_to_console(int fd)
 {
 	char *clipboard, *c;
@@ -715,14 +2743,8 @@ static void clipboard_to_console(int fd)
 	free(clipboard);
 }
 
-static void backend_init(const char *backend_opts, int reverse)
+static void colors_init(int reverse)
 {
-	backend = gp_backend_init(backend_opts, 0, 0, "Termini");
-	if (!backend) {
-		fprintf(stderr, "Failed to initalize backend\n");
-		exit(1);
-	}
-
 	if (reverse) {
 		bg_color_idx = 0;
 		fg_color_idx = 7;
@@ -741,28 +2763,292 @@ static void backend_init(const char *backend_opts, int reverse)
 	default:
 		init_colors_rgb(backend);
 	}
+}
+
+static void backend_init(const char *backend_opts, int reverse)
+{
+	backend = gp_backend_init(backend_opts, 0, 0, "Termini");
+	if (!backend) {
+		fprintf(stderr, "Failed to initalize backend\n");
+		exit(1);
+	}
+
+	colors_init(reverse);
 
 	gp_backend_cursor_set(backend, GP_BACKEND_CURSOR_TEXT_EDIT);
+	last_motion_ms = time_ms();
 	gp_backend_timer_start(backend, &hide_cursor_timer);
 }
 
+/*
+ * Allocates the image tiles for the current cell size.
+ */
+static int images_init(void)
+{
+	const struct RGB *bg = &RGB_colors[bg_color_idx];
+
+	if (sixel_init((size_t)image_cache_kb * 1024, backend->pixmap->pixel_type,
+	               char_width, char_height, bg->r, bg->g, bg->b)) {
+		fprintf(stderr, "Failed to allocate image cache\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * URL and file:line hints, Ctrl+Shift+U selects them from the keyboard and
+ * Ctrl+click opens the one under the pointer.
+ */
+static int hints_enabled = 1;
+static int hint_mode;
+static const char *open_cmd = "xdg-open";
+
+/*
+ * Runs the open command with the hint text as an argument. The command is
+ * double forked so that it does not have to be reaped and it's started in the
+ * working directory of the foreground process so that relative paths resolve.
+ */
+static void hint_open(const struct hint *hint, int fd)
+{
+	char text[1024];
+	char cmd[256];
+	char cwd[64];
+	pid_t pid, pgrp;
+
+	if (hints_text(hint, text, sizeof(text)))
+		return;
+
+	pgrp = tcgetpgrp(fd);
+	snprintf(cwd, sizeof(cwd), "/proc/%i/cwd", pgrp > 0 ? pgrp : console_pid);
+	snprintf(cmd, sizeof(cmd), "%s \"$1\"", open_cmd);
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "fork(): %s\n", strerror(errno));
+		return;
+	}
+
+	if (pid == 0) {
+		if (fork() == 0) {
+			close(fd);
+			setsid();
+
+			if (chdir(cwd))
+				_exit(1);
+
+			execl("/bin/sh", "sh", "-c", cmd, "sh", text, NULL);
+			_exit(127);
+		}
+
+		_exit(0);
+	}
+
+	waitpid(pid, NULL, 0);
+}
+
+static void hints_redraw(void)
+{
+	hints_damage_rows();
+	repaint_damage();
+}
+
+static void hint_mode_enter(void)
+{
+	struct hint hint;
+
+	render_sync();
+	view_leave();
+
+	if (hints_select(-1, &hint))
+		return;
+
+	hint_mode = 1;
+	hints_redraw();
+}
+
+static void hint_mode_exit(void)
+{
+	render_sync();
+	hint_mode = 0;
+	hints_select_clear();
+	hints_redraw();
+}
+
+static void hint_key(gp_event *ev, int fd)
+{
+	struct hint hint;
+
+	switch (ev->val) {
+	case GP_KEY_ESC:
+		hint_mode_exit();
+	break;
+	case GP_KEY_UP:
+	case GP_KEY_DOWN:
+		render_sync();
+
+		if (hints_select(ev->val == GP_KEY_UP ? -1 : 1, &hint))
+			hint_mode_exit();
+		else
+			hints_redraw();
+	break;
+	case GP_KEY_ENTER:
+		render_sync();
+
+		if (!hints_select(0, &hint))
+			hint_open(&hint, fd);
+
+		hint_mode_exit();
+	break;
+	}
+}
+
+/*
+ * Ctrl+left click opens the hint under the pointer, returns non-zero if the
+ * event was consumed.
+ */
+static int hint_click(gp_event *ev, int fd)
+{
+	struct hint hint;
+	int col, row;
+
+	if (!hints_map || view_scrolled || ev->val != GP_BTN_LEFT ||
+	    ev->code != GP_EV_KEY_DOWN)
+		return 0;
+
+	if (!gp_ev_any_key_pressed(ev, GP_KEY_LEFT_CTRL, GP_KEY_RIGHT_CTRL))
+		return 0;
+
+	col = ev->st->cursor_x / char_width;
+	row = ev->st->cursor_y / char_height;
+
+	render_sync();
+
+	if (hints_at(row, col, &hint))
+		return 0;
+
+	hint_open(&hint, fd);
+
+	return 1;
+}
+
+/*
+ * Font zoom, the requests are only recorded and applied once the event queue
+ * is drained or together with a window resize, so that a burst of key presses
+ * ends up in a single relayout and repaint.
+ */
+static unsigned int zoom_base;
+static unsigned int zoom_cur;
+static unsigned int zoom_next;
+
+static void zoom_request(int level)
+{
+	zoom_next = GP_MAX(0, GP_MIN(level, (int)zoom_levels() - 1));
+}
+
+static void zoom_apply(void)
+{
+	const struct zoom_level *level = zoom_level(zoom_next);
+
+	zoom_cur = zoom_next;
+
+	text_style = &level->style;
+	text_style_bold = &level->style_bold;
+	char_width = level->char_width;
+	char_height = level->char_height;
+
+	/* Tiles are cell sized, images shown so far are drawn as background */
+	if (sixel_enabled)
+		images_init();
+}
+
+/*
+ * Recomputes the terminal size from the window size and the font and redraws
+ * the whole screen.
+ */
+static void term_relayout(int fd)
+{
+	render_sync();
+	view_reset();
+
+	if (zoom_next != zoom_cur)
+		zoom_apply();
+
+	cols = GP_MAX(1u, gp_pixmap_w(backend->pixmap)/char_width);
+	rows = GP_MAX(1u, gp_pixmap_h(backend->pixmap)/char_height);
+	term_clamp_size();
+	vterm_set_size(vt, rows, cols);
+	search_resize(rows, cols);
+	hint_mode = 0;
+	if (hints_enabled && hints_resize(rows, cols))
+		fprintf(stderr, "Failed to allocate hints\n");
+	console_resize(fd, cols, rows);
+	gp_fill(backend->pixmap, colors[bg_color_idx]);
+
+	/* The whole screen is repainted, the cell sizes may have changed */
+	dbg_cnt = 0;
+
+	VTermRect rect = {.start_row = 0, .start_col = 0, .end_row = rows, .end_col = cols};
+	term_damage(rect, NULL);
+	damage_cause = FLUSH_RESIZE;
+	repaint_damage();
+}
+
 static void print_help(const char *name, int exit_val)
 {
 	gp_fonts_iter i;
 	const gp_font_family *f;
 
-	printf("usage: %s [-r] [-b backend_opts] [-F font_family]\n\n", name);
+	printf("usage: %s [-r] [-a] [-g] [-b backend_opts] [-F font_family] [-m arena_kb]\n"
+	       "       [-s history_kb] [-z zoom]\n\n", name);
 
 	printf(" -b backend init string (pass -b help for options)\n");
 	printf(" -r reverse colors\n");
+	printf(" -g keep cells in own grid instead of the libvterm screen\n");
+	printf(" --pipeline rasterize in a render thread while parsing, implies -g\n");
+	printf(" -m low memory profile, allocates terminal state from fixed arena\n");
+	printf("    of arena_kb kilobytes (0 disables, default %i)\n", CONFIG_LOWMEM_ARENA_KB);
+	printf(" -a enable alternate screen in low memory profile\n");
+	printf(" -s search history size in kilobytes (default %i)\n", SEARCH_HISTORY_KB);
+	printf(" --scrollback=mb scrollback size cap in megabytes, spilled to $TMPDIR\n");
+	printf("    (0 disables, default %i)\n", SCROLLBACK_MB);
+	printf(" --image-cache=kb sixel image cache size in kilobytes, images are shown\n");
+	printf("    in grid mode only (0 disables, default %i)\n", IMAGE_CACHE_KB);
+	printf(" --mem-report print memory usage breakdown on startup and exit\n");
+	printf(" --stats print wakeups and other counters on exit\n");
+	printf(" --hud show performance overlay on startup\n");
+	printf(" --io-uring use io_uring for the PTY I/O if available\n");
+	printf(" --startup-profile print time to backend ready, first PTY byte and first frame\n");
+	printf(" --export-shm[=name] export framebuffer to POSIX shared memory\n");
+	printf("    (default /termini-<pid>)\n");
+	printf(" --control[=path] serve counters over a UNIX socket\n");
+	printf("    (default $XDG_RUNTIME_DIR/termini-<pid>.sock)\n");
+	printf(" --open-cmd=cmd command the hints are opened with (default xdg-open)\n");
+	printf(" --no-hints disable URL and file:line hints\n");
+	printf(" --no-fastpath pass plain text through libvterm in grid mode as well\n");
+	printf(" --debug-damage outline flushed rectangles colored by the cause, green\n");
+	printf("    text, red cursor, blue resize, magenta full flip, yellow overlay\n");
 	printf(" -F gfpxrim font family\n");
 	printf("    Available fonts families:\n");
 	GP_FONT_FAMILY_FOREACH(&i, f)
 		printf("\t - %s\n", f->family_name);
+	printf(" -z initial zoom in steps, negative values zoom out, the steps are the\n");
+	printf("    other sizes of the font family and integer pixel multipliers\n");
+
+	printf("\nKeys:\n");
+	printf(" Ctrl+Shift+F search, Ctrl+R toggles regex, Up/Enter and Down move\n");
+	printf("              between matches, Esc ends the search\n");
+	printf(" Ctrl+Shift+P toggles performance overlay\n");
+	printf(" Ctrl+Shift+D toggles damage visualization\n");
+	printf(" Shift+PgUp/PgDown and mouse wheel scroll back through the history\n");
+	printf(" Ctrl+Shift+Plus/Minus zooms in/out, Ctrl+Shift+0 resets the zoom\n");
+	printf(" Ctrl+Shift+U selects URL and file:line hints, Up and Down move between\n");
+	printf("              them, Enter opens, Esc cancels, Ctrl+click opens as well\n");
 
 	exit(exit_val);
 }
 
+#ifndef TERMINI_BENCH
 /*
  * Emulate vt220 for monochrome and grayscale, that limits most of the
  * applications from using colors in a way that produce an unreadable output
@@ -780,20 +3066,110 @@ int main(int argc, char *argv[])
 	const char *color_fg_bg = NULL;
 	const gp_font_family *ffamily;
 	int reverse = 0;
-	int is_grayscale;
 	const char *color = NULL;;
+	int history_kb = SEARCH_HISTORY_KB;
+	int arena_kb = CONFIG_LOWMEM_ARENA_KB;
+	int force_altscreen = 0;
+	const char *shm_name = NULL;
+	const char *control_path = NULL;
+	int control = 0;
+	const char *term = "TERM=xterm";
+	int zoom_steps = 0;
+	int fd = -1;
+	int ret;
+
+	startup_start = stats_time_us();
+
+	static const struct option long_opts[] = {
+		{"mem-report", no_argument, NULL, 'R'},
+		{"stats", no_argument, NULL, 'S'},
+		{"hud", no_argument, NULL, 'H'},
+		{"io-uring", no_argument, NULL, 'U'},
+		{"export-shm", optional_argument, NULL, 'E'},
+		{"grid", no_argument, NULL, 'g'},
+		{"startup-profile", no_argument, NULL, 'P'},
+		{"scrollback", required_argument, NULL, 'B'},
+		{"pipeline", no_argument, NULL, 'L'},
+		{"image-cache", required_argument, NULL, 'I'},
+		{"control", optional_argument, NULL, 'C'},
+		{"open-cmd", required_argument, NULL, 'O'},
+		{"no-hints", no_argument, NULL, 'N'},
+		{"no-fastpath", no_argument, NULL, 'A'},
+		{"debug-damage", no_argument, NULL, 'D'},
+		{NULL, 0, NULL, 0}
+	};
 
-	while ((opt = getopt(argc, argv, "b:F:hr")) != -1) {
+	while ((opt = getopt_long(argc, argv, "ab:F:ghm:rs:z:", long_opts, NULL)) != -1) {
 		switch (opt) {
+		case 'a':
+			force_altscreen = 1;
+		break;
 		case 'b':
 			backend_opts = optarg;
 		break;
 		case 'F':
 			font_family = optarg;
 		break;
+		case 'g':
+			grid_mode = 1;
+		break;
+		case 'L':
+			pipeline = 1;
+			grid_mode = 1;
+		break;
+		case 'P':
+			startup_pending = 1;
+		break;
 		case 'h':
 			print_help(argv[0], 0);
 		break;
+		case 'm':
+			arena_kb = atoi(optarg);
+		break;
+		case 'R':
+			mem_report_enabled = 1;
+		break;
+		case 's':
+			history_kb = atoi(optarg);
+		break;
+		case 'z':
+			zoom_steps = atoi(optarg);
+		break;
+		case 'B':
+			scrollback_mb = atoi(optarg);
+		break;
+		case 'I':
+			image_cache_kb = atoi(optarg);
+		break;
+		case 'S':
+			stats_enabled = 1;
+		break;
+		case 'H':
+			hud_enabled = 1;
+		break;
+		case 'U':
+			io_uring = 1;
+		break;
+		case 'E':
+			shm_export = 1;
+			shm_name = optarg;
+		break;
+		case 'C':
+			control = 1;
+			control_path = optarg;
+		break;
+		case 'O':
+			open_cmd = optarg;
+		break;
+		case 'N':
+			hints_enabled = 0;
+		break;
+		case 'A':
+			fastpath_enabled = 0;
+		break;
+		case 'D':
+			dbg_damage = 1;
+		break;
 		case 'r':
 			reverse = 1;
 			/* libvterm does not implement xterm specific CSI to get fg/bg */
@@ -804,50 +3180,121 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/*
+	 * When TERM does not depend on the backend the shell is started before
+	 * the backend is initialized and the size is corrected once the backend
+	 * is up. Output produced meanwhile stays in the PTY until the terminal
+	 * is ready.
+	 */
+	if (backend_is_color(backend_opts)) {
+		fd = open_console(term, color_fg_bg, 80, 24);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to start shell: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		if (startup_pending)
+			startup_mark(STARTUP_FORK);
+	}
+
 	ffamily = gp_font_family_lookup(font_family);
 	if (!ffamily) {
 		fprintf(stderr, "Error; Font family %s not found!\n\n", font_family);
 		print_help(argv[0], 1);
 	}
 
-	gp_text_style style = {
-		.font = gp_font_family_face_lookup(ffamily, GP_FONT_MONO),
-	        .pixel_xmul = 1,
-		.pixel_ymul = 1,
-	};
+	zoom_base = zoom_init(ffamily);
+	if (!zoom_levels()) {
+		fprintf(stderr, "Error; Font family %s has no monospace font!\n\n", font_family);
+		print_help(argv[0], 1);
+	}
 
-	gp_text_style style_bold = {
-		.font = gp_font_family_face_lookup(ffamily, GP_FONT_MONO | GP_FONT_BOLD),
-	        .pixel_xmul = 1,
-		.pixel_ymul = 1,
-	};
+	zoom_request((int)zoom_base + zoom_steps);
+	zoom_apply();
+
+	stats_start();
+
+	if (arena_kb > 0) {
+		if (mem_arena_init((size_t)arena_kb * 1024)) {
+			fprintf(stderr, "Failed to allocate %i kB arena\n", arena_kb);
+			exit(1);
+		}
 
-	text_style = &style;
-	text_style_bold = &style_bold;
+		altscreen = force_altscreen;
+	}
 
-	char_width  = gp_text_max_width(text_style, 1);
-	char_height = gp_text_height(text_style);
+	cell_kernels_init();
 
 	backend_init(backend_opts, reverse);
 
+	if (startup_pending)
+		startup_mark(STARTUP_BACKEND);
+
 	is_grayscale = gp_pixel_size(backend->pixmap->pixel_type) <= 4;
 
 	cols = gp_pixmap_w(backend->pixmap)/char_width;
 	rows = gp_pixmap_h(backend->pixmap)/char_height;
 
-	fprintf(stderr, "Cols %i Rows %i\n", cols, rows);
+	fprintf(stderr, "Cols %i Rows %i Kernels %s\n", cols, rows, cell_kernels_name());
+
+	if (grid_mode && image_cache_kb > 0 && !images_init())
+		sixel_enabled = 1;
 
 	term_init();
 
-	int fd;
+	if (pipeline && render_init()) {
+		fprintf(stderr, "Failed to start render thread, rendering synchronously\n");
+		pipeline = 0;
+	}
+
+	if (scrollback_mb < 0)
+		scrollback_mb = 0;
+
+	if (scrollback_mb &&
+	    scrollback_init((size_t)scrollback_mb * 1024 * 1024,
+	                    fg_color_idx, bg_color_idx)) {
+		fprintf(stderr, "Failed to allocate scrollback\n");
+		scrollback_mb = 0;
+	}
 
-	if (is_grayscale)
-		fd = open_console("TERM=xterm-r5", color_fg_bg);
+	if (scrollback_mb)
+		ret = search_init_lines(grid_mode ? grid_row_text : screen_row_text,
+		                        scrollback_text, scrollback_range);
 	else
-		fd = open_console("TERM=xterm", color_fg_bg);
+		ret = search_init((size_t)history_kb * 1024,
+		                  grid_mode ? grid_row_text : screen_row_text);
+
+	if (ret || search_resize(rows, cols))
+		fprintf(stderr, "Failed to allocate search index\n");
+
+	if (hints_enabled &&
+	    (hints_init(grid_mode ? grid_row_text : screen_row_text) ||
+	     hints_resize(rows, cols)))
+		fprintf(stderr, "Failed to allocate hints\n");
+
+	/* Grayscale is known only now, a shell started early keeps its TERM */
+	if (fd < 0) {
+		if (is_grayscale)
+			term = "TERM=xterm-r5";
+
+		fd = open_console(term, color_fg_bg, cols, rows);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to start shell: %s\n", strerror(errno));
+			exit(1);
+		}
+
+		if (startup_pending)
+			startup_mark(STARTUP_FORK);
+	}
+
+	if (startup_pending)
+		startup_mark(STARTUP_TERM);
 
 	vterm_output_set_callback(vt, term_output_callback, &fd);
 
+	if (hud_enabled)
+		gp_backend_timer_start(backend, &hud_timer);
+
 	gp_fd pfd = {
 		.fd = fd,
 		.event = console_read,
@@ -855,18 +3302,68 @@ int main(int argc, char *argv[])
 		.priv = backend,
 	};
 
+	if (io_uring) {
+		int ring_fd = pty_uring_init(fd, console_uring_read);
+
+		if (ring_fd < 0) {
+			fprintf(stderr, "Falling back to poll for PTY I/O\n");
+			io_uring = 0;
+		} else {
+			pfd.fd = ring_fd;
+			pfd.event = console_uring_event;
+		}
+	}
+
 	gp_backend_poll_add(backend, &pfd);
+
+	gp_fd render_pfd = {
+		.fd = render_efd,
+		.event = render_event,
+		.events = GP_POLLIN,
+	};
+
+	if (pipeline)
+		gp_backend_poll_add(backend, &render_pfd);
+
+	if (control)
+		control_init(backend, control_path);
 	console_resize(fd, cols, rows);
 
 	gp_fill(backend->pixmap, colors[bg_color_idx]);
 
+	if (shm_export) {
+		char name[64];
+
+		if (!shm_name) {
+			snprintf(name, sizeof(name), "/termini-%i", getpid());
+			shm_name = name;
+		}
+
+		if (shm_export_init(shm_name, backend->pixmap))
+			shm_export = 0;
+	}
+
+	if (mem_report_enabled)
+		mem_report(stderr);
+
+	/* Everything from now on is supposed to run without allocations */
+	stats_allocs_start();
+
 	for (;;) {
 		gp_event *ev;
 
 		while ((ev = gp_backend_ev_wait(backend))) {
 			//gp_ev_dump(ev);
+			stats.event_wakeups++;
+
 			switch (ev->type) {
 			case GP_EV_KEY:
+				if (hint_click(ev, fd))
+					break;
+
+				if (mouse_button(ev))
+					break;
+
 				if (ev->code == GP_EV_KEY_UP)
 					break;
 
@@ -879,30 +3376,101 @@ int main(int argc, char *argv[])
 					continue;
 				}
 
+				if (search_mode) {
+					search_key(ev);
+					break;
+				}
+
+				if (hint_mode) {
+					hint_key(ev, fd);
+					break;
+				}
+
+				if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_CTRL, GP_KEY_RIGHT_CTRL) &&
+				    gp_ev_any_key_pressed(ev, GP_KEY_LEFT_SHIFT, GP_KEY_RIGHT_SHIFT)) {
+					if (ev->val == GP_KEY_F) {
+						view_leave();
+						search_enter();
+						break;
+					}
+
+					if (ev->val == GP_KEY_P) {
+						hud_toggle();
+						break;
+					}
+
+					if (ev->val == GP_KEY_D) {
+						dbg_toggle();
+						break;
+					}
+
+					if (ev->val == GP_KEY_U && hints_map) {
+						hint_mode_enter();
+						break;
+					}
+
+					if (ev->val == GP_KEY_EQUAL || ev->val == GP_KEY_KP_PLUS) {
+						zoom_request(zoom_next + 1);
+						break;
+					}
+
+					if (ev->val == GP_KEY_MINUS || ev->val == GP_KEY_KP_MINUS) {
+						zoom_request((int)zoom_next - 1);
+						break;
+					}
+
+					if (ev->val == GP_KEY_0) {
+						zoom_request(zoom_base);
+						break;
+					}
+				}
+
+				if (gp_ev_any_key_pressed(ev, GP_KEY_LEFT_SHIFT, GP_KEY_RIGHT_SHIFT)) {
+					if (ev->val == GP_KEY_PAGE_UP) {
+						view_scroll(GP_MAX(1u, rows / 2));
+						break;
+					}
+
+					if (ev->val == GP_KEY_PAGE_DOWN) {
+						view_scroll(-(int)GP_MAX(1u, rows / 2));
+						break;
+					}
+				}
+
 				if (is_grayscale)
 					key_to_console_xterm_r5(ev, fd);
 				else
 					key_to_console_xterm(ev, fd);
 			break;
 			case GP_EV_UTF:
+				if (search_mode) {
+					search_utf(ev);
+					break;
+				}
+
+				if (hint_mode)
+					break;
+
 				utf_to_console(ev, fd);
 			break;
 			case GP_EV_REL:
+				if (ev->code == GP_EV_REL_WHEEL) {
+					mouse_wheel(ev);
+					break;
+				}
+			/* fallthrough */
 			case GP_EV_ABS:
 				hide_cursor_reschedule();
+				mouse_move(ev);
 			break;
 			case GP_EV_SYS:
 				switch (ev->code) {
 				case GP_EV_SYS_RESIZE:
+					render_sync();
 					gp_backend_resize_ack(backend);
-					cols = GP_MAX(1u, ev->sys.w/char_width);
-					rows = GP_MAX(1u, ev->sys.h/char_height);
-					vterm_set_size(vt, rows, cols);
-					console_resize(fd, cols, rows);
-					gp_fill(backend->pixmap, colors[bg_color_idx]);
-					VTermRect rect = {.start_row = 0, .start_col = 0, .end_row = rows, .end_col = cols};
-					term_damage(rect, NULL);
-					repaint_damage();
+					if (shm_export)
+						shm_export_resize(backend->pixmap);
+					term_relayout(fd);
 				break;
 				case GP_EV_SYS_QUIT:
 					do_exit(fd);
@@ -912,14 +3480,33 @@ int main(int argc, char *argv[])
 				break;
 				case GP_EV_SYS_FOCUS:
 					focused = ev->val;
-					if (cursor_visible)
+					if (cursor_visible && render_busy) {
+						merge_damage(cell_rect(cursor_col, cursor_row));
+					} else if (cursor_visible && !render_suspended()) {
 						repaint_cursor();
+					}
+					if (focused)
+						hide_cursor_reschedule();
+				break;
+#ifdef HAVE_EV_SYS_VISIBILITY
+				case GP_EV_SYS_VISIBILITY:
+					set_hidden(!ev->val);
 				break;
+#endif
 				}
 			break;
 			}
+
+			/* Key presses are written in a batch once the queue is drained */
+			if (io_uring && !gp_backend_ev_queued(backend))
+				pty_uring_flush();
+
+			if (zoom_next != zoom_cur && !gp_backend_ev_queued(backend))
+				term_relayout(fd);
 		}
 	}
 
 	return 0;
 }
+
+#endif /* TERMINI_BENCH */
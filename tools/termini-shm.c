@@ -0,0 +1,270 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Reference consumer for the termini framebuffer export.
+
+   Saves PNG snapshots of the exported framebuffer or follows the dirty
+   rectangle stream and measures the lag between the flush in termini and
+   the moment the rectangle was picked up.
+
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gfxprim.h>
+
+#include "../shm_export.h"
+
+#define POLL_US 1000
+
+static int shm_fd;
+static struct shm_fb_header *hdr;
+static size_t map_size;
+
+static uint64_t time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int shm_remap(void)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(shm_fd, &st)) {
+		fprintf(stderr, "fstat: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if ((size_t)st.st_size == map_size)
+		return 0;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "mmap: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (hdr)
+		munmap(hdr, map_size);
+
+	hdr = map;
+	map_size = st.st_size;
+
+	return 0;
+}
+
+static int shm_attach(const char *name)
+{
+	shm_fd = shm_open(name, O_RDONLY, 0);
+	if (shm_fd < 0) {
+		fprintf(stderr, "shm_open(%s): %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	if (shm_remap())
+		return -1;
+
+	if (map_size < sizeof(*hdr) || hdr->magic != SHM_FB_MAGIC ||
+	    hdr->version != SHM_FB_VERSION) {
+		fprintf(stderr, "%s is not a termini framebuffer\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct geom {
+	uint32_t w, h, bytes_per_row, pixel_type, pixels_offset;
+	uint64_t size;
+};
+
+/*
+ * Reads consistent geometry, remaps the segment when it has grown.
+ */
+static int read_geom(struct geom *geom, uint32_t *geom_seq)
+{
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&hdr->geom_seq, __ATOMIC_ACQUIRE);
+
+		if (seq & 1) {
+			usleep(POLL_US);
+			continue;
+		}
+
+		geom->w = hdr->w;
+		geom->h = hdr->h;
+		geom->bytes_per_row = hdr->bytes_per_row;
+		geom->pixel_type = hdr->pixel_type;
+		geom->pixels_offset = hdr->pixels_offset;
+		geom->size = hdr->size;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&hdr->geom_seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	*geom_seq = seq;
+
+	if (geom->size > map_size && shm_remap())
+		return -1;
+
+	return 0;
+}
+
+static int snapshot(const char *path)
+{
+	struct geom geom;
+	uint32_t geom_seq;
+	gp_pixmap pixmap;
+
+	if (read_geom(&geom, &geom_seq))
+		return 1;
+
+	/* Zero copy, the pixmap points into the shared memory */
+	gp_pixmap_init(&pixmap, geom.w, geom.h, geom.pixel_type,
+	               (uint8_t*)hdr + geom.pixels_offset, 0);
+	/* The backend pixmap rows may be padded */
+	pixmap.bytes_per_row = geom.bytes_per_row;
+
+	if (gp_save_png(&pixmap, path, NULL)) {
+		fprintf(stderr, "Failed to save %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Follows the dirty rectangle stream and prints lag statistics every second.
+ */
+static int measure_lag(void)
+{
+	uint64_t last_seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+	uint64_t lag_sum = 0, lag_max = 0, rects = 0, pixels = 0, overruns = 0;
+	uint64_t report = time_us() + 1000000;
+	struct geom geom;
+	uint32_t geom_seq, cur_geom_seq;
+
+	if (read_geom(&geom, &geom_seq))
+		return 1;
+
+	for (;;) {
+		uint64_t head = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		uint64_t now = time_us();
+
+		cur_geom_seq = __atomic_load_n(&hdr->geom_seq, __ATOMIC_ACQUIRE);
+		if (cur_geom_seq != geom_seq) {
+			if (read_geom(&geom, &geom_seq))
+				return 1;
+			printf("resized to %ux%u\n", geom.w, geom.h);
+		}
+
+		if (head - last_seq > SHM_FB_RING_SIZE) {
+			/* A real consumer would reread the whole frame */
+			overruns++;
+			last_seq = head;
+		}
+
+		while (last_seq < head) {
+			uint64_t seq = last_seq + 1;
+			const struct shm_fb_rect *r = &hdr->ring[seq % SHM_FB_RING_SIZE];
+			uint64_t s1 = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+			uint64_t t = r->time_us;
+			uint32_t area = (uint32_t)r->w * r->h;
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+			if (s1 != seq || __atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq) {
+				overruns++;
+				last_seq = head;
+				break;
+			}
+
+			lag_sum += now - t;
+			lag_max = GP_MAX(lag_max, now - t);
+			pixels += area;
+			rects++;
+			last_seq = seq;
+		}
+
+		if (now >= report) {
+			printf("rects %6llu pixels %10llu lag avg %6.1fus max %6lluus overruns %llu\n",
+			       (unsigned long long)rects, (unsigned long long)pixels,
+			       rects ? (double)lag_sum / rects : 0.0,
+			       (unsigned long long)lag_max, (unsigned long long)overruns);
+			fflush(stdout);
+
+			lag_sum = lag_max = rects = pixels = overruns = 0;
+			report = now + 1000000;
+		}
+
+		usleep(POLL_US);
+	}
+
+	return 0;
+}
+
+static void print_help(const char *name, int exit_val)
+{
+	printf("usage: %s -n /termini-PID [-p file.png | -l]\n\n", name);
+	printf(" -n shared memory segment name\n");
+	printf(" -p save snapshot into a PNG file\n");
+	printf(" -l measure update lag\n");
+
+	exit(exit_val);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = NULL, *png = NULL;
+	int opt, lag = 0;
+
+	while ((opt = getopt(argc, argv, "hln:p:")) != -1) {
+		switch (opt) {
+		case 'h':
+			print_help(argv[0], 0);
+		break;
+		case 'l':
+			lag = 1;
+		break;
+		case 'n':
+			name = optarg;
+		break;
+		case 'p':
+			png = optarg;
+		break;
+		default:
+			print_help(argv[0], 1);
+		}
+	}
+
+	if (!name || (!png && !lag))
+		print_help(argv[0], 1);
+
+	if (shm_attach(name))
+		return 1;
+
+	if (png)
+		return snapshot(png);
+
+	return measure_lag();
+}
@@ -0,0 +1,130 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zoom.h"
+
+static struct zoom_level levels[ZOOM_LEVELS_MAX];
+static unsigned int levels_cnt;
+
+/*
+ * Returns the length of the family name without the numeric size suffix.
+ */
+static size_t name_prefix_len(const char *name)
+{
+	size_t len = strlen(name);
+
+	while (len && isdigit((unsigned char)name[len-1]))
+		len--;
+
+	return len;
+}
+
+static int same_family(const char *name, const char *other)
+{
+	size_t len = name_prefix_len(name);
+
+	if (len == strlen(name) || len == 0)
+		return !strcmp(name, other);
+
+	return len == name_prefix_len(other) && strlen(other) > len &&
+	       !strncmp(name, other, len);
+}
+
+static void level_add(const gp_font_family *family, unsigned int mul)
+{
+	const gp_font_face *font = gp_font_family_face_lookup(family, GP_FONT_MONO);
+	const gp_font_face *bold = gp_font_family_face_lookup(family, GP_FONT_MONO | GP_FONT_BOLD);
+	struct zoom_level *level = &levels[levels_cnt];
+	unsigned int i;
+
+	if (!font || levels_cnt >= ZOOM_LEVELS_MAX)
+		return;
+
+	level->style = (gp_text_style) {
+		.font = font,
+		.pixel_xmul = mul,
+		.pixel_ymul = mul,
+	};
+
+	level->style_bold = level->style;
+	if (bold)
+		level->style_bold.font = bold;
+
+	level->char_width = gp_text_max_width(&level->style, 1);
+	level->char_height = gp_text_height(&level->style);
+
+	/* Same cell size, prefer the smaller multiplier */
+	for (i = 0; i < levels_cnt; i++) {
+		if (levels[i].char_width != level->char_width ||
+		    levels[i].char_height != level->char_height)
+			continue;
+
+		if (levels[i].style.pixel_xmul > level->style.pixel_xmul)
+			levels[i] = *level;
+
+		return;
+	}
+
+	levels_cnt++;
+}
+
+static int level_cmp(const void *a, const void *b)
+{
+	const struct zoom_level *la = a, *lb = b;
+
+	if (la->char_height != lb->char_height)
+		return la->char_height < lb->char_height ? -1 : 1;
+
+	if (la->char_width != lb->char_width)
+		return la->char_width < lb->char_width ? -1 : 1;
+
+	return 0;
+}
+
+unsigned int zoom_init(const gp_font_family *family)
+{
+	const gp_font_face *base = gp_font_family_face_lookup(family, GP_FONT_MONO);
+	const gp_font_family *f;
+	gp_fonts_iter iter;
+	unsigned int mul, i;
+
+	levels_cnt = 0;
+
+	/* The requested family goes first so that it wins over same sized ones */
+	level_add(family, 1);
+
+	for (mul = 1; mul <= ZOOM_MUL_MAX; mul++) {
+		if (mul > 1)
+			level_add(family, mul);
+
+		GP_FONT_FAMILY_FOREACH(&iter, f) {
+			if (f != family && same_family(family->family_name, f->family_name))
+				level_add(f, mul);
+		}
+	}
+
+	qsort(levels, levels_cnt, sizeof(*levels), level_cmp);
+
+	for (i = 0; i < levels_cnt; i++) {
+		if (levels[i].style.font == base && levels[i].style.pixel_xmul == 1)
+			return i;
+	}
+
+	return 0;
+}
+
+unsigned int zoom_levels(void)
+{
+	return levels_cnt;
+}
+
+const struct zoom_level *zoom_level(unsigned int level)
+{
+	return &levels[level];
+}
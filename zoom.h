@@ -0,0 +1,54 @@
+//SPDX-License-Identifier: GPL-2.1-or-later
+/*
+ * Copyright (C) 2023-2025 Cyril Hrubis <metan@ucw.cz>
+ */
+
+ /*
+
+   Font zoom levels.
+
+   The levels are built from the font family sizes, i.e. families that differ
+   only in the numeric suffix such as haxor-narrow-15 and haxor-narrow-18,
+   combined with integer pixel multipliers. The levels are sorted by the cell
+   size and levels with the same cell size are merged, preferring the native
+   font size over a multiplied one.
+
+   The text styles are allocated once, the glyph caches are keyed by the font
+   and the multiplier, so switching back to a level that was used recently
+   does not rasterize the glyphs again.
+
+  */
+
+#ifndef ZOOM_H
+#define ZOOM_H
+
+#include <gfxprim.h>
+
+#define ZOOM_MUL_MAX 4
+#define ZOOM_LEVELS_MAX 32
+
+struct zoom_level {
+	gp_text_style style;
+	gp_text_style style_bold;
+	unsigned int char_width;
+	unsigned int char_height;
+};
+
+/*
+ * Builds the zoom levels for a font family.
+ *
+ * Returns the index of the level with the family at 1:1.
+ */
+unsigned int zoom_init(const gp_font_family *family);
+
+/*
+ * Returns the number of zoom levels.
+ */
+unsigned int zoom_levels(void);
+
+/*
+ * Returns a zoom level, level has to be smaller than zoom_levels().
+ */
+const struct zoom_level *zoom_level(unsigned int level);
+
+#endif /* ZOOM_H */